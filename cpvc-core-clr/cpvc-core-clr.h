@@ -53,6 +53,43 @@ namespace CPvC {
             return _pCore->RevertToSnapshot(id);
         }
 
+        void SetSnapshotKeyframes(UInt32 interval, UInt64 diffBytes)
+        {
+            msclr::lock l(_lockObject);
+
+            _pCore->SetSnapshotKeyframes(interval, diffBytes);
+        }
+
+        array<UInt32>^ GetSnapshotDepths()
+        {
+            msclr::lock l(_lockObject);
+
+            size_t size = _pCore->GetSnapshotDepths(nullptr, 0);
+
+            array<UInt32>^ depths = gcnew array<UInt32>((int)size);
+            if (size > 0)
+            {
+                pin_ptr<UInt32> buffer = &depths[0];
+                _pCore->GetSnapshotDepths((dword*)buffer, depths->Length);
+            }
+
+            return depths;
+        }
+
+        void SetSnapshotBudget(UInt64 bytes)
+        {
+            msclr::lock l(_lockObject);
+
+            _pCore->SetSnapshotBudget(bytes);
+        }
+
+        UInt64 SnapshotBytes()
+        {
+            msclr::lock l(_lockObject);
+
+            return _pCore->SnapshotBytes();
+        }
+
         void LoadLowerROM(array<byte>^ lowerRom)
         {
             if (lowerRom->Length != 0x4000)
@@ -87,7 +124,7 @@ namespace CPvC {
             byte reason = 0;
             {
                 msclr::lock l(_lockObject);
-                reason = _pCore->RunUntil(stopTicks, stopReason, &tempSamples);
+                reason = _pCore->RunUntil(stopTicks, stopReason, (samples != nullptr) ? &tempSamples : nullptr);
             }
 
             if (samples != nullptr)
@@ -135,6 +172,41 @@ namespace CPvC {
             }
         }
 
+        // The buffer must remain valid (and not be moved) until replaced, for example by being a bitmap's back buffer.
+        void SetScreenBuffer(IntPtr pBuffer, UInt64 pitch, byte format)
+        {
+            msclr::lock l(_lockObject);
+
+            _pCore->SetScreenBuffer((byte*)pBuffer.ToPointer(), pitch, (ScreenFormat)format);
+        }
+
+        void EnableFrameBuffers(bool enabled)
+        {
+            msclr::lock l(_lockObject);
+
+            _pCore->EnableFrameBuffers(enabled);
+        }
+
+        // The callback should be a native function pointer, such as one obtained from Marshal::GetFunctionPointerForDelegate.
+        void SetFrameReadyCallback(IntPtr callback, IntPtr context)
+        {
+            msclr::lock l(_lockObject);
+
+            _pCore->SetFrameReadyCallback((FrameReadyCallback)callback.ToPointer(), context.ToPointer());
+        }
+
+        // Deliberately doesn't take the lock, so a presenter thread can read the latest frame while RunUntil is executing.
+        // Returns IntPtr::Zero if frame buffers aren't enabled. As this doesn't take the lock, the presenter must be
+        // stopped before frame buffers are disabled.
+        IntPtr LatestFrame([Runtime::InteropServices::Out] UInt64% sequence)
+        {
+            qword frameSequence = 0;
+            const byte* pFrame = (_pCore != nullptr) ? _pCore->LatestFrame(frameSequence) : nullptr;
+            sequence = frameSequence;
+
+            return IntPtr((void*)pFrame);
+        }
+
         array<byte>^ GetScreen()
         {
             msclr::lock l(_lockObject);
@@ -153,6 +225,29 @@ namespace CPvC {
             return screen;
         }
 
+        void EnableDirtyLines(bool enabled)
+        {
+            msclr::lock l(_lockObject);
+
+            _pCore->EnableDirtyLines(enabled);
+        }
+
+        array<byte>^ GetDirtyLines()
+        {
+            msclr::lock l(_lockObject);
+
+            size_t size = _pCore->GetDirtyLines(nullptr, 0);
+
+            array<byte>^ dirtyLines = gcnew array<byte>((int)size);
+            if (size > 0)
+            {
+                pin_ptr<byte> buffer = &dirtyLines[0];
+                _pCore->GetDirtyLines(buffer, dirtyLines->Length);
+            }
+
+            return dirtyLines;
+        }
+
         bool KeyPress(byte keycode, bool down)
         {
             msclr::lock l(_lockObject);
@@ -202,6 +297,95 @@ namespace CPvC {
             _pCore->SetFrequency(frequency);
         }
 
+        void SetAudioFormat(byte format)
+        {
+            msclr::lock l(_lockObject);
+
+            _pCore->SetAudioFormat((AudioFormat)format);
+        }
+
+        // The buffer must remain valid (and not be moved) until replaced, for example by being allocated with
+        // Marshal::AllocHGlobal. Samples can then be read by passing a null list to RunUntil, and calling ReadAudio.
+        // As ReadAudio doesn't take the lock, the audio device must be stopped before the buffer is replaced or removed.
+        void SetAudioBuffer(IntPtr pBuffer, UInt64 size)
+        {
+            msclr::lock l(_lockObject);
+
+            _pCore->SetAudioBuffer((word*)pBuffer.ToPointer(), size);
+        }
+
+        // Deliberately doesn't take the lock, so an audio device's callback can read samples while RunUntil is executing.
+        UInt64 ReadAudio(IntPtr pSamples, UInt64 count)
+        {
+            return (_pCore != nullptr) ? _pCore->ReadAudio((word*)pSamples.ToPointer(), count) : 0;
+        }
+
+        UInt64 AudioOverflows()
+        {
+            return (_pCore != nullptr) ? _pCore->AudioOverflows() : 0;
+        }
+
+        UInt64 AudioUnderflows()
+        {
+            return (_pCore != nullptr) ? _pCore->AudioUnderflows() : 0;
+        }
+
+        void EnableLazyTicks(bool enabled)
+        {
+            msclr::lock l(_lockObject);
+
+            _pCore->EnableLazyTicks(enabled);
+        }
+
+        void EnableBlockExecution(bool enabled)
+        {
+            msclr::lock l(_lockObject);
+
+            _pCore->EnableBlockExecution(enabled);
+        }
+
+        void EnableIdleSkip(bool enabled)
+        {
+            msclr::lock l(_lockObject);
+
+            _pCore->EnableIdleSkip(enabled);
+        }
+
+        qword IdleTicksSkipped()
+        {
+            msclr::lock l(_lockObject);
+
+            return _pCore->IdleTicksSkipped();
+        }
+
+        qword PenBytesRewritten()
+        {
+            msclr::lock l(_lockObject);
+
+            return _pCore->PenBytesRewritten();
+        }
+
+        void EnableHeadless(bool enabled)
+        {
+            msclr::lock l(_lockObject);
+
+            _pCore->EnableHeadless(enabled);
+        }
+
+        void SetFrameSkip(UInt32 frames)
+        {
+            msclr::lock l(_lockObject);
+
+            _pCore->SetFrameSkip(frames);
+        }
+
+        void EnableSSSE3Rendering(bool enabled)
+        {
+            msclr::lock l(_lockObject);
+
+            _pCore->EnableSSSE3Rendering(enabled);
+        }
+
         array<byte>^ GetState()
         {
             StreamWriter s;
@@ -0,0 +1,294 @@
+#include <chrono>
+#include <iostream>
+
+#include "gtest/gtest.h"
+#include "../cpvc-core/Core.h"
+#include "../cpvc-core/Encode.h"
+#include "helpers.h"
+
+// Benchmarks are disabled by default; run them with --gtest_also_run_disabled_tests, preferably with a release build.
+
+// Loads a program that repeatedly executes a mix of unprefixed, CB, ED, DD and DDCB instructions, incrementing DE on
+// each iteration of its loop.
+void LoadBenchmarkProgram(Core* pCore)
+{
+    bytevector program = {
+        0xF3,                       // DI
+        0x31, 0x00, 0xC0,           // LD SP,0xC000
+        0xDD, 0x21, 0x00, 0x80,     // LD IX,0x8000
+        0x11, 0x00, 0x00,           // LD DE,0x0000
+        0x3C,                       // loop: INC A
+        0xC6, 0x07,                 // ADD A,0x07
+        0x27,                       // DAA
+        0x05,                       // DEC B
+        0xA8,                       // XOR B
+        0xB1,                       // OR C
+        0xCB, 0x01,                 // RLC C
+        0xCB, 0x47,                 // BIT 0,A
+        0xED, 0x44,                 // NEG
+        0xED, 0x4A,                 // ADC HL,BC
+        0xDD, 0x77, 0x01,           // LD (IX+1),A
+        0xDD, 0x7E, 0x02,           // LD A,(IX+2)
+        0xDD, 0xCB, 0x03, 0xC6,     // SET 0,(IX+3)
+        0xE5,                       // PUSH HL
+        0xE1,                       // POP HL
+        0x13,                       // INC DE
+        0xC3, 0x0B, 0x00            // JP loop
+    };
+
+    pCore->EnableLowerROM(false);
+
+    for (word addr = 0; addr < program.size(); addr++)
+    {
+        pCore->WriteRAM(addr, program[addr]);
+    }
+}
+
+// Number of instructions executed in each iteration of the benchmark program's loop.
+constexpr qword benchmarkLoopInstructions = 17;
+
+// Runs the benchmark program for the specified number of emulated seconds, calling RunUntil with the given stop reason,
+// and returns the number of Z80 instructions executed per second of real time.
+double RunBenchmarkProgram(Core* pCore, int seconds, byte stopReason = stopNone)
+{
+    qword instructions = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int s = 0; s < seconds; s++)
+    {
+        pCore->DE = 0;
+
+        qword ticksEnd = pCore->Ticks() + 4000000;
+        while (pCore->Ticks() < ticksEnd)
+        {
+            pCore->RunUntil(ticksEnd, stopReason, nullptr);
+        }
+
+        instructions += pCore->DE * benchmarkLoopInstructions;
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return instructions / elapsed.count();
+}
+
+TEST(BenchmarkTests, DISABLED_InstructionsPerSecond)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    LoadBenchmarkProgram(pCore.get());
+
+    // Act
+    double instructionsPerSecond = RunBenchmarkProgram(pCore.get(), 20);
+
+    // Verify
+    std::cout << "Instructions per second: " << (qword)instructionsPerSecond << std::endl;
+    ASSERT_GT(instructionsPerSecond, 0);
+}
+
+TEST(BenchmarkTests, DISABLED_BlockExecutionInstructionsPerSecond)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    LoadBenchmarkProgram(pCore.get());
+    pCore->EnableBlockExecution(true);
+
+    // Act
+    double instructionsPerSecond = RunBenchmarkProgram(pCore.get(), 20);
+
+    // Verify
+    std::cout << "Instructions per second: " << (qword)instructionsPerSecond << std::endl;
+    ASSERT_GT(instructionsPerSecond, 0);
+}
+
+// Stopping at each VSync is how frontends normally run the core, so this measures the cost of that check.
+TEST(BenchmarkTests, DISABLED_StopVSyncInstructionsPerSecond)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    LoadBenchmarkProgram(pCore.get());
+
+    // Act
+    double instructionsPerSecond = RunBenchmarkProgram(pCore.get(), 20, stopVSync);
+
+    // Verify
+    std::cout << "Instructions per second: " << (qword)instructionsPerSecond << std::endl;
+    ASSERT_GT(instructionsPerSecond, 0);
+}
+
+// Runs a halted core with a full screen of varied pixels for the specified number of emulated seconds in the given
+// mode, and returns the number of frames rendered per second of real time.
+double RunRenderBenchmark(Core* pCore, int seconds, byte mode)
+{
+    bytevector program = {
+        0xF3,                               // DI
+        0x01, (byte)(0x8C | mode), 0x7F,    // LD BC,0x7F8C + mode
+        0xED, 0x49,                         // OUT (C),C
+        0x76                                // HALT
+    };
+
+    pCore->EnableLowerROM(false);
+    pCore->SetScreen(768, 288, 768);
+
+    for (word addr = 0; addr < program.size(); addr++)
+    {
+        pCore->WriteRAM(addr, program[addr]);
+    }
+
+    for (dword addr = 0xC000; addr < 0x10000; addr++)
+    {
+        pCore->WriteRAM((word)addr, (byte)(addr * 37));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    pCore->RunUntil(pCore->Ticks() + seconds * 4000000, stopNone, nullptr);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return (seconds * 50) / elapsed.count();
+}
+
+TEST(BenchmarkTests, DISABLED_RenderFramesPerSecond)
+{
+    for (bool ssse3 : { false, true })
+    {
+        for (byte mode = 0; mode < 4; mode++)
+        {
+            // Setup
+            std::unique_ptr<Core> pCore = std::make_unique<Core>();
+            pCore->EnableSSSE3Rendering(ssse3);
+
+            // Act
+            double framesPerSecond = RunRenderBenchmark(pCore.get(), 20, mode);
+
+            // Verify
+            std::cout << (ssse3 ? "SSSE3" : "Table") << " mode " << (int)mode << " frames per second: " << (qword)framesPerSecond << std::endl;
+            ASSERT_GT(framesPerSecond, 0);
+        }
+    }
+}
+
+// Defined in CoreTests.cpp.
+void LoadVSyncPollingProgram(Core* pCore, byte amplitude);
+
+// Measures how quickly a VSync polling loop runs, with and without idle loop skipping, while a tone is playing and
+// audio samples are being generated, as in a menu which plays music.
+TEST(BenchmarkTests, DISABLED_IdleSkipWithToneSecondsPerSecond)
+{
+    for (bool idleSkip : { false, true })
+    {
+        // Setup
+        std::unique_ptr<Core> pCore = std::make_unique<Core>();
+        LoadVSyncPollingProgram(pCore.get(), 15);
+        pCore->EnableIdleSkip(idleSkip);
+
+        constexpr int seconds = 20;
+        wordvector samples;
+
+        // Act
+        auto start = std::chrono::steady_clock::now();
+        for (int s = 0; s < seconds; s++)
+        {
+            qword ticksEnd = pCore->Ticks() + 4000000;
+            while (pCore->Ticks() < ticksEnd)
+            {
+                samples.clear();
+                pCore->RunUntil(ticksEnd, stopVSync, &samples);
+            }
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        // Verify
+        double secondsPerSecond = seconds / elapsed.count();
+        std::cout << (idleSkip ? "Idle skip" : "No idle skip") << " emulated seconds per second: " << secondsPerSecond << std::endl;
+        ASSERT_GT(secondsPerSecond, 0);
+    }
+}
+
+// Measures how quickly a snapshot-sized buffer can be XOR encoded against a parent differing from it in a few places.
+TEST(BenchmarkTests, DISABLED_XorEncodeBytesPerSecond)
+{
+    // Setup
+    bytevector parent(0x40000);
+    for (size_t i = 0; i < parent.size(); i++)
+    {
+        parent[i] = (byte)(i * 37);
+    }
+
+    bytevector bytes = parent;
+    for (size_t i = 0; i < bytes.size(); i += 997)
+    {
+        bytes[i] ^= 0xFF;
+    }
+
+    bytevector encoded;
+    constexpr int iterations = 5000;
+
+    // Act
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        XorRunLengthEncode(bytes.data(), bytes.size(), parent.data(), parent.size(), encoded);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    // Verify
+    double bytesPerSecond = (bytes.size() * (double)iterations) / elapsed.count();
+    std::cout << "Bytes per second: " << (qword)bytesPerSecond << std::endl;
+    ASSERT_GT(bytesPerSecond, 0);
+}
+
+// Compares the total size of the diffs between the serialized state of successive frames in the original encoding and
+// in version 2, for a session running the benchmark program over a full screen of varied pixels.
+TEST(BenchmarkTests, DISABLED_SnapshotDiffSizes)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    LoadBenchmarkProgram(pCore.get());
+    pCore->SetScreen(768, 288, 768);
+
+    for (dword addr = 0xC000; addr < 0x10000; addr++)
+    {
+        pCore->WriteRAM((word)addr, (byte)(addr * 37));
+    }
+
+    bytevector parent;
+    Serialize::Write(parent, *pCore);
+
+    size_t originalSize = 0;
+    size_t version2Size = 0;
+    size_t fullSize = 0;
+
+    // Act
+    for (int frame = 0; frame < 500; frame++)
+    {
+        pCore->RunUntil(pCore->Ticks() + 80000, stopVSync, nullptr);
+
+        bytevector state;
+        Serialize::Write(state, *pCore);
+
+        bytevector diff = state;
+        for (size_t i = 0; i < std::min(diff.size(), parent.size()); i++)
+        {
+            diff[i] ^= parent[i];
+        }
+
+        bytevector encoded;
+        RunLengthEncode(diff.data(), diff.size(), encoded);
+        originalSize += encoded.size();
+
+        XorRunLengthEncode(state.data(), state.size(), parent.data(), parent.size(), encoded);
+        version2Size += encoded.size();
+
+        fullSize += state.size();
+        parent = state;
+    }
+
+    // Verify
+    std::cout << "Full state bytes: " << fullSize << std::endl;
+    std::cout << "Original diff bytes: " << originalSize << std::endl;
+    std::cout << "Version 2 diff bytes: " << version2Size << std::endl;
+    ASSERT_GT(originalSize, 0);
+}
@@ -1,5 +1,10 @@
+#include <numeric>
+#include <random>
+#include <set>
+
 #include "gtest/gtest.h"
 #include "../cpvc-core/Core.h"
+#include "../cpvc-core/CoreSnapshot.h"
 #include "helpers.h"
 
 bytevector CoreState(Core* pCore)
@@ -204,6 +209,1026 @@ TEST(CoreTests, RunUntilVSync)
     ASSERT_LE(vSyncCount, 51);
 }
 
+// Loads a small program that sets the pens, writes to screen memory and changes the border colour, while taking
+// interrupts that record the value of the B register (and thus when they were taken) in memory.
+void LoadInterruptTestProgram(Core* pCore)
+{
+    bytevector program = {
+        0xF3,               // DI
+        0xED, 0x56,         // IM 1
+        0x31, 0x00, 0xC0,   // LD SP,0xC000
+        0x21, 0x00, 0xC0,   // LD HL,0xC000
+        0x01, 0x0F, 0x7F,   // LD BC,0x7F0F
+        0xED, 0x49,         // pens: OUT (C),C
+        0x79,               // LD A,C
+        0xF6, 0x40,         // OR 0x40
+        0xED, 0x79,         // OUT (C),A
+        0x0D,               // DEC C
+        0x20, 0xF6,         // JR NZ,pens
+        0xFB,               // EI
+        0x01, 0x10, 0x7F,   // loop: LD BC,0x7F10
+        0xED, 0x49,         // OUT (C),C
+        0x7D,               // LD A,L
+        0xE6, 0x1F,         // AND 0x1F
+        0xF6, 0x40,         // OR 0x40
+        0xED, 0x79,         // OUT (C),A
+        0x06, 0x08,         // LD B,0x08
+        0x10, 0xFE,         // delay: DJNZ delay
+        0xED, 0x5F,         // LD A,R
+        0x77,               // LD (HL),A
+        0x2C,               // INC L
+        0x18, 0xEA          // JR loop
+    };
+
+    bytevector interruptHandler = {
+        0xF5,               // PUSH AF
+        0x78,               // LD A,B
+        0x32, 0x00, 0x40,   // LD (0x4000),A
+        0xF1,               // POP AF
+        0xFB,               // EI
+        0xC9                // RET
+    };
+
+    pCore->EnableLowerROM(false);
+    pCore->SetScreen(768, 288, 768);
+
+    for (word addr = 0; addr < program.size(); addr++)
+    {
+        pCore->WriteRAM(addr, program[addr]);
+    }
+
+    for (word addr = 0; addr < interruptHandler.size(); addr++)
+    {
+        pCore->WriteRAM(0x0038 + addr, interruptHandler[addr]);
+    }
+}
+
+// Runs two cores for one second and ensures their state, screen, and audio are identical at every frame.
+void RunAndCompare(Core* pCore1, Core* pCore2)
+{
+    qword ticksEnd = pCore1->Ticks() + 4000000;
+
+    while (pCore1->Ticks() < ticksEnd)
+    {
+        wordvector samples1;
+        wordvector samples2;
+
+        pCore1->RunUntil(ticksEnd, stopVSync, &samples1);
+        pCore2->RunUntil(ticksEnd, stopVSync, &samples2);
+
+        bytevector screen1(pCore1->GetScreen(nullptr, 0));
+        pCore1->GetScreen(screen1.data(), screen1.size());
+        bytevector screen2(pCore2->GetScreen(nullptr, 0));
+        pCore2->GetScreen(screen2.data(), screen2.size());
+
+        ASSERT_EQ(CoreState(pCore1), CoreState(pCore2));
+        ASSERT_EQ(screen1, screen2);
+        ASSERT_EQ(samples1, samples2);
+    }
+}
+
+TEST(CoreTests, LazyTicks)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    std::unique_ptr<Core> pLazyCore = std::make_unique<Core>();
+    LoadInterruptTestProgram(pCore.get());
+    LoadInterruptTestProgram(pLazyCore.get());
+
+    // Act
+    pLazyCore->EnableLazyTicks(true);
+
+    // Verify
+    RunAndCompare(pCore.get(), pLazyCore.get());
+}
+
+TEST(CoreTests, BlockExecution)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    std::unique_ptr<Core> pBlockCore = std::make_unique<Core>();
+    LoadInterruptTestProgram(pCore.get());
+    LoadInterruptTestProgram(pBlockCore.get());
+
+    // Act
+    pBlockCore->EnableBlockExecution(true);
+
+    // Verify
+    RunAndCompare(pCore.get(), pBlockCore.get());
+}
+
+// Runs the given program on two cores, one normally and one a single tick at a time (which renders each character as
+// it's reached), and ensures their state and screens are identical every millisecond.
+void RunAndCompareStepped(const bytevector& program, qword ticks)
+{
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    std::unique_ptr<Core> pSteppedCore = std::make_unique<Core>();
+    for (Core* pC : { pCore.get(), pSteppedCore.get() })
+    {
+        pC->EnableLowerROM(false);
+        pC->SetScreen(768, 288, 768);
+
+        for (word addr = 0; addr < program.size(); addr++)
+        {
+            pC->WriteRAM(addr, program[addr]);
+        }
+    }
+
+    qword ticksEnd = pCore->Ticks() + ticks;
+
+    while (pCore->Ticks() < ticksEnd)
+    {
+        pCore->RunUntil(pCore->Ticks() + 4000, stopNone);
+        while (pSteppedCore->Ticks() < pCore->Ticks())
+        {
+            pSteppedCore->RunUntil(pSteppedCore->Ticks() + 1, stopNone);
+        }
+
+        bytevector screen(pCore->GetScreen(nullptr, 0));
+        pCore->GetScreen(screen.data(), screen.size());
+        bytevector steppedScreen(pSteppedCore->GetScreen(nullptr, 0));
+        pSteppedCore->GetScreen(steppedScreen.data(), steppedScreen.size());
+
+        ASSERT_EQ(CoreState(pCore.get()), CoreState(pSteppedCore.get()));
+        ASSERT_EQ(screen, steppedScreen);
+    }
+}
+
+// Ensures that changes to the border, pens, mode and CRTC registers partway through a scan line are rendered correctly.
+TEST(CoreTests, VideoRenderMidLineChanges)
+{
+    // Setup
+    bytevector program = {
+        0xF3,               // DI
+        0x21, 0x00, 0xC0,   // LD HL,0xC000
+        0x1E, 0x00,         // LD E,0x00
+        0x01, 0x10, 0x7F,   // loop: LD BC,0x7F10
+        0xED, 0x49,         // OUT (C),C
+        0x7B,               // LD A,E
+        0xE6, 0x1F,         // AND 0x1F
+        0xF6, 0x40,         // OR 0x40
+        0xED, 0x79,         // OUT (C),A
+        0x0E, 0x01,         // LD C,0x01
+        0xED, 0x49,         // OUT (C),C
+        0xEE, 0x15,         // XOR 0x15
+        0xED, 0x79,         // OUT (C),A
+        0x7B,               // LD A,E
+        0xE6, 0x03,         // AND 0x03
+        0xF6, 0x8C,         // OR 0x8C
+        0xED, 0x79,         // OUT (C),A
+        0x01, 0x01, 0xBC,   // LD BC,0xBC01
+        0xED, 0x49,         // OUT (C),C
+        0x7B,               // LD A,E
+        0xE6, 0x0F,         // AND 0x0F
+        0xC6, 0x20,         // ADD A,0x20
+        0x04,               // INC B
+        0xED, 0x79,         // OUT (C),A
+        0x73,               // LD (HL),E
+        0x23,               // INC HL
+        0xCB, 0xFC,         // SET 7,H
+        0xCB, 0xF4,         // SET 6,H
+        0x1C,               // INC E
+        0x18, 0xCF          // JR loop
+    };
+
+    // Act and Verify
+    RunAndCompareStepped(program, 160000);
+}
+
+// Ensures that writes to screen memory the CRTC has just read from are rendered correctly. With a maximum raster
+// address of 0, each character row is one scan line, and with 127 of them per frame, the 2K of screen memory is
+// displayed several times over, so the program's writes keep being overtaken by the CRTC. The values written are chosen
+// so they differ from those written on the previous pass.
+TEST(CoreTests, VideoRenderMidLineMemoryWrites)
+{
+    // Setup
+    bytevector program = {
+        0xF3,               // DI
+        0x01, 0x0F, 0x7F,   // LD BC,0x7F0F
+        0xED, 0x49,         // pens: OUT (C),C
+        0x79,               // LD A,C
+        0xF6, 0x40,         // OR 0x40
+        0xED, 0x79,         // OUT (C),A
+        0x0D,               // DEC C
+        0x20, 0xF6,         // JR NZ,pens
+        0x01, 0x04, 0xBC,   // LD BC,0xBC04
+        0xED, 0x49,         // OUT (C),C
+        0x01, 0x7E, 0xBD,   // LD BC,0xBD7E
+        0xED, 0x49,         // OUT (C),C
+        0x01, 0x06, 0xBC,   // LD BC,0xBC06
+        0xED, 0x49,         // OUT (C),C
+        0x01, 0x64, 0xBD,   // LD BC,0xBD64
+        0xED, 0x49,         // OUT (C),C
+        0x01, 0x07, 0xBC,   // LD BC,0xBC07
+        0xED, 0x49,         // OUT (C),C
+        0x01, 0x6E, 0xBD,   // LD BC,0xBD6E
+        0xED, 0x49,         // OUT (C),C
+        0x01, 0x09, 0xBC,   // LD BC,0xBC09
+        0xED, 0x49,         // OUT (C),C
+        0x01, 0x00, 0xBD,   // LD BC,0xBD00
+        0xED, 0x49,         // OUT (C),C
+        0x21, 0x00, 0xC0,   // LD HL,0xC000
+        0x77,               // loop: LD (HL),A
+        0x23,               // INC HL
+        0xCB, 0x9C,         // RES 3,H
+        0x07,               // RLCA
+        0x3C,               // INC A
+        0x18, 0xF8          // JR loop
+    };
+
+    // Act and Verify
+    RunAndCompareStepped(program, 160000);
+}
+
+// Ensures that running headless doesn't affect the state of the core, and that once rendering is re-enabled, the next
+// full frame is identical to that of a core which was never headless.
+TEST(CoreTests, Headless)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    std::unique_ptr<Core> pHeadlessCore = std::make_unique<Core>();
+    LoadInterruptTestProgram(pCore.get());
+    LoadInterruptTestProgram(pHeadlessCore.get());
+    pHeadlessCore->EnableHeadless(true);
+
+    qword ticksEnd = pCore->Ticks() + 4000000;
+    wordvector headlessSamples;
+
+    // Act
+    while (pCore->Ticks() < ticksEnd)
+    {
+        pCore->RunUntil(ticksEnd, stopVSync, nullptr);
+        pHeadlessCore->RunUntil(ticksEnd, stopVSync, &headlessSamples);
+    }
+
+    bytevector headlessScreen(pHeadlessCore->GetScreen(nullptr, 0));
+    pHeadlessCore->GetScreen(headlessScreen.data(), headlessScreen.size());
+
+    pHeadlessCore->EnableHeadless(false);
+
+    // Verify
+    ASSERT_EQ(CoreState(pCore.get()), CoreState(pHeadlessCore.get()));
+    ASSERT_TRUE(headlessSamples.empty());
+    ASSERT_EQ(headlessScreen, bytevector(headlessScreen.size(), 0));
+
+    // Run for one partial and one full frame, so the screen has been completely redrawn.
+    for (int frame = 0; frame < 2; frame++)
+    {
+        pCore->RunUntil(ticksEnd + 80000, stopVSync, nullptr);
+        pHeadlessCore->RunUntil(ticksEnd + 80000, stopVSync, nullptr);
+    }
+
+    RunAndCompare(pCore.get(), pHeadlessCore.get());
+}
+
+// Ensures that rendering directly into a caller's buffer, in each of the supported formats, gives the same screen as
+// the core's own buffer.
+TEST(CoreTests, ScreenBuffer)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    LoadInterruptTestProgram(pCore.get());
+
+    constexpr size_t width = 768;
+    constexpr size_t height = 288;
+
+    std::vector<std::unique_ptr<Core>> bufferCores;
+    bytevector index8Buffer((width + 16) * height);
+
+    // As with the core's own buffer, start with every pixel in hardware colour 0, so undrawn areas match.
+    std::vector<word> rgb565Buffer(width * height, 0x8410);
+    std::vector<dword> xrgb8888Buffer(width * height, hardwareColours[0]);
+
+    for (int c = 0; c < 3; c++)
+    {
+        bufferCores.push_back(std::make_unique<Core>());
+        LoadInterruptTestProgram(bufferCores.back().get());
+    }
+
+    bufferCores[0]->SetScreenBuffer(index8Buffer.data(), width + 16, screenIndex8);
+    bufferCores[1]->SetScreenBuffer((byte*)rgb565Buffer.data(), width * sizeof(word), screenRGB565);
+    bufferCores[2]->SetScreenBuffer((byte*)xrgb8888Buffer.data(), width * sizeof(dword), screenXRGB8888);
+
+    qword ticksEnd = pCore->Ticks() + 2000000;
+
+    while (pCore->Ticks() < ticksEnd)
+    {
+        // Act
+        pCore->RunUntil(ticksEnd, stopVSync, nullptr);
+        for (std::unique_ptr<Core>& pBufferCore : bufferCores)
+        {
+            pBufferCore->RunUntil(ticksEnd, stopVSync, nullptr);
+        }
+
+        // Verify
+        bytevector screen(pCore->GetScreen(nullptr, 0));
+        pCore->GetScreen(screen.data(), screen.size());
+
+        for (size_t y = 0; y < height; y++)
+        {
+            for (size_t x = 0; x < width; x++)
+            {
+                byte colour = screen[y * width + x];
+                dword rgb = hardwareColours[colour];
+                word rgb565 = (word)(((rgb >> 8) & 0xF800) | ((rgb >> 5) & 0x07E0) | ((rgb >> 3) & 0x001F));
+
+                ASSERT_EQ(colour, index8Buffer[y * (width + 16) + x]);
+                ASSERT_EQ(rgb565, rgb565Buffer[y * width + x]);
+                ASSERT_EQ(rgb, xrgb8888Buffer[y * width + x]);
+            }
+        }
+    }
+
+    // Ensure the screen wasn't just a single colour.
+    ASSERT_NE(std::count(xrgb8888Buffer.begin(), xrgb8888Buffer.end(), xrgb8888Buffer[0]), xrgb8888Buffer.size());
+}
+
+void CountFrame(void* pContext, qword sequence)
+{
+    qword* pFrames = (qword*)pContext;
+    (*pFrames)++;
+
+    ASSERT_EQ(*pFrames, sequence);
+}
+
+// Ensures that each frame published at the start of a VSync matches the core's own screen at that point, and that
+// LatestFrame only moves on to a different buffer when a new frame has been published.
+TEST(CoreTests, FrameBuffers)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    std::unique_ptr<Core> pFrameCore = std::make_unique<Core>();
+    LoadInterruptTestProgram(pCore.get());
+    LoadInterruptTestProgram(pFrameCore.get());
+
+    qword frames = 0;
+    pFrameCore->EnableFrameBuffers(true);
+    pFrameCore->SetFrameReadyCallback(CountFrame, &frames);
+
+    qword ticksEnd = pCore->Ticks() + 2000000;
+    std::set<const byte*> buffers;
+
+    while (pCore->Ticks() < ticksEnd)
+    {
+        // Act
+        byte stopReason = pCore->RunUntil(ticksEnd, stopVSync, nullptr);
+        pFrameCore->RunUntil(ticksEnd, stopVSync, nullptr);
+
+        qword sequence = 0;
+        const byte* pFrame = pFrameCore->LatestFrame(sequence);
+        qword sequence2 = 0;
+        const byte* pFrame2 = pFrameCore->LatestFrame(sequence2);
+        buffers.insert(pFrame);
+
+        // Verify
+        ASSERT_EQ(frames, sequence);
+        ASSERT_EQ(sequence, sequence2);
+        ASSERT_EQ(pFrame, pFrame2);
+
+        // Only compare once every buffer has had a full frame rendered into it.
+        if (stopReason == stopVSync && sequence > 4)
+        {
+            bytevector screen(pCore->GetScreen(nullptr, 0));
+            pCore->GetScreen(screen.data(), screen.size());
+
+            ASSERT_EQ(0, memcmp(screen.data(), pFrame, screen.size()));
+        }
+    }
+
+    ASSERT_GE(frames, 24);
+    ASSERT_EQ(buffers.size(), 3);
+}
+
+// Ensures the pen bytes rewritten are counted per frame, so that setting the pens once at the start of the program
+// only counts towards the first frame, whether rendering with the rendered pen bytes or with SSSE3.
+TEST(CoreTests, PenBytesRewrittenPerFrame)
+{
+    for (bool ssse3 : { false, true })
+    {
+        // Setup
+        std::unique_ptr<Core> pCore = std::make_unique<Core>();
+        LoadInterruptTestProgram(pCore.get());
+        pCore->EnableSSSE3Rendering(ssse3);
+        qword total = 0;
+
+        for (int frame = 0; frame < 10; frame++)
+        {
+            // Act
+            pCore->RunUntil(pCore->Ticks() + 200000, stopVSync, nullptr);
+            total += pCore->PenBytesRewritten();
+
+            // Verify
+            if (frame >= 2)
+            {
+                ASSERT_EQ(pCore->PenBytesRewritten(), 0);
+            }
+        }
+
+        ASSERT_GT(total, 0);
+    }
+}
+
+// Ensures LatestFrame returns nothing before frame buffers have been enabled, or after they've been disabled.
+TEST(CoreTests, FrameBuffersNone)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    LoadInterruptTestProgram(pCore.get());
+    qword sequence = 1;
+
+    // Act
+    const byte* pFrame = pCore->LatestFrame(sequence);
+
+    // Verify
+    ASSERT_EQ(pFrame, nullptr);
+    ASSERT_EQ(sequence, 0);
+
+    // Act - enable frame buffers, run until a frame has been published, then disable them.
+    pCore->EnableFrameBuffers(true);
+    pCore->RunUntil(pCore->Ticks() + 200000, stopNone, nullptr);
+    ASSERT_NE(pCore->LatestFrame(sequence), nullptr);
+    ASSERT_GT(sequence, 0);
+
+    pCore->EnableFrameBuffers(false);
+    pFrame = pCore->LatestFrame(sequence);
+
+    // Verify
+    ASSERT_EQ(pFrame, nullptr);
+    ASSERT_EQ(sequence, 0);
+}
+
+// Ensures that, at various frequencies, the number of audio samples generated over a long run is exactly the same as
+// that given by computing the microsecond of each sample in floating point, as AudioRender previously did.
+TEST(CoreTests, AudioSampleCount)
+{
+    for (dword frequency : { 44100, 48000, 96000 })
+    {
+        // Setup
+        std::unique_ptr<Core> pCore = std::make_unique<Core>();
+        LoadInterruptTestProgram(pCore.get());
+        pCore->SetFrequency(frequency);
+
+        qword sampleCount = 0;
+        qword ticksStart = pCore->Ticks();
+
+        qword expectedUs = 0;
+        qword expectedSampleCount = 0;
+        dword tickTotal = 0;
+        dword ticksToNextSample = 0;
+        dword sampleIndex = 0;
+
+        for (int stop = 1; stop <= 40; stop++)
+        {
+            // Act - stop at irregular points, so that samples fall at every possible position within each run.
+            wordvector samples;
+            pCore->RunUntil(ticksStart + stop * 400037, stopNone, &samples);
+            sampleCount += samples.size();
+
+            // Verify
+            qword us = (pCore->Ticks() - ticksStart) / 4;
+            for (; expectedUs < us; expectedUs++)
+            {
+                if (tickTotal >= ticksToNextSample)
+                {
+                    expectedSampleCount++;
+                    sampleIndex++;
+                    if (sampleIndex >= frequency)
+                    {
+                        sampleIndex = 0;
+                        tickTotal = 0;
+                    }
+
+                    ticksToNextSample = (dword)((((double)sampleIndex) * 1000000.0) / ((double)frequency));
+                }
+
+                tickTotal++;
+            }
+
+            ASSERT_EQ(expectedSampleCount, sampleCount);
+        }
+    }
+}
+
+// Ensures a frequency of 0 doesn't cause a divide by zero, either when set or when loading a core which has it.
+TEST(CoreTests, AudioZeroFrequency)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    LoadInterruptTestProgram(pCore.get());
+
+    // Act
+    pCore->SetFrequency(0);
+
+    wordvector samples;
+    pCore->RunUntil(pCore->Ticks() + 4000, stopNone, &samples);
+
+    // The frequency is the last thing written, so zero it as an old snapshot might have.
+    StreamWriter writer;
+    writer << *pCore;
+    bytevector state;
+    writer.CopyTo(state);
+    std::fill(state.end() - sizeof(dword), state.end(), 0);
+
+    std::unique_ptr<Core> pLoadedCore = std::make_unique<Core>();
+    StreamReader reader;
+    reader.SetBuffer(state.data(), state.size());
+    reader >> *pLoadedCore;
+    pLoadedCore->RunUntil(pLoadedCore->Ticks() + 4000, stopNone, &samples);
+
+    // Verify
+    ASSERT_FALSE(samples.empty());
+}
+
+// Loads a program which writes the given values to the PSG's registers, then halts.
+void LoadPSGProgram(Core* pCore, const bytevector& registers)
+{
+    bytevector program = {
+        0xF3,               // DI
+        0x01, 0x82, 0xF7,   // LD BC,0xF782
+        0xED, 0x49,         // OUT (C),C
+        0x21, 0x30, 0x00,   // LD HL,registers
+        0x7E,               // loop: LD A,(HL)
+        0xFE, 0xFF,         // CP 0xFF
+        0x28, 0x21,         // JR Z,done
+        0x06, 0xF4,         // LD B,0xF4
+        0xED, 0x79,         // OUT (C),A
+        0x06, 0xF6,         // LD B,0xF6
+        0x0E, 0xC0,         // LD C,0xC0
+        0xED, 0x49,         // OUT (C),C
+        0x0E, 0x00,         // LD C,0x00
+        0xED, 0x49,         // OUT (C),C
+        0x23,               // INC HL
+        0x7E,               // LD A,(HL)
+        0x06, 0xF4,         // LD B,0xF4
+        0xED, 0x79,         // OUT (C),A
+        0x06, 0xF6,         // LD B,0xF6
+        0x0E, 0x80,         // LD C,0x80
+        0xED, 0x49,         // OUT (C),C
+        0x0E, 0x00,         // LD C,0x00
+        0xED, 0x49,         // OUT (C),C
+        0x23,               // INC HL
+        0x18, 0xDA,         // JR loop
+        0x76                // done: HALT
+    };
+
+    pCore->EnableLowerROM(false);
+
+    for (word addr = 0; addr < program.size(); addr++)
+    {
+        pCore->WriteRAM(addr, program[addr]);
+    }
+
+    for (word addr = 0; addr < registers.size(); addr++)
+    {
+        pCore->WriteRAM(0x0030 + addr, registers[addr]);
+    }
+
+    pCore->WriteRAM((word)(0x0030 + registers.size()), 0xFF);
+}
+
+// Ensures that with the tone and noise generators disabled, the mono and stereo samples are the sum of each channel's
+// constant level, with channel B split between left and right, centred on zero.
+TEST(CoreTests, AudioPCMLevels)
+{
+    for (AudioFormat format : { audioMono16, audioStereo16 })
+    {
+        // Setup
+        std::unique_ptr<Core> pCore = std::make_unique<Core>();
+        LoadPSGProgram(pCore.get(), { 7, 0x3F, 8, 15, 9, 10, 10, 5 });
+        pCore->SetAudioFormat(format);
+
+        wordvector samples;
+        pCore->RunUntil(40000, stopNone, &samples);
+
+        // Act
+        samples.clear();
+        pCore->RunUntil(80000, stopNone, &samples);
+
+        // Verify
+        ASSERT_EQ(format == audioStereo16 ? 960 : 480, samples.size());
+
+        for (size_t s = 0; s < samples.size(); s++)
+        {
+            int expected = (format == audioMono16) ?
+                (ayLevels[15] + ayLevels[10] + ayLevels[5] - audioMono16Midpoint) :
+                (((s % 2) == 0 ? ayLevels[15] : ayLevels[5]) + ayLevels[10] / 2 - audioStereo16Midpoint);
+
+            ASSERT_EQ(expected, (int16_t)samples[s]);
+        }
+    }
+}
+
+// Ensures that a tone whose period is shorter than a sample is averaged over each sample, rather than just sampled.
+TEST(CoreTests, AudioPCMAveraging)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    LoadPSGProgram(pCore.get(), { 0, 1, 1, 0, 7, 0x3E, 8, 15 });
+    pCore->SetAudioFormat(audioMono16);
+
+    wordvector samples;
+    pCore->RunUntil(40000, stopNone, &samples);
+
+    // Act
+    samples.clear();
+    pCore->RunUntil(440000, stopNone, &samples);
+
+    // Verify - the tone is high for 8 of every 16 microseconds.
+    int64_t total = 0;
+    for (word sample : samples)
+    {
+        ASSERT_GT((int16_t)sample, ayLevels[15] / 4 - audioMono16Midpoint);
+        ASSERT_LT((int16_t)sample, ayLevels[15] * 3 / 4 - audioMono16Midpoint);
+
+        total += (int16_t)sample;
+    }
+
+    ASSERT_NEAR(total / (int64_t)samples.size(), ayLevels[15] / 2 - audioMono16Midpoint, 10);
+}
+
+TEST(CoreTests, AudioRingBuffer)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    LoadPSGProgram(pCore.get(), { 0, 1, 1, 0, 7, 0x3E, 8, 15 });
+    pCore->SetAudioFormat(audioStereo16);
+
+    word ring[64];
+    pCore->SetAudioBuffer(ring, 64);
+
+    // Act - drain the ring buffer after every few samples.
+    wordvector samples;
+    wordvector ringSamples;
+    for (int i = 0; i < 100; i++)
+    {
+        pCore->RunUntil(pCore->Ticks() + 400, stopNone, &samples);
+
+        word buffer[64];
+        size_t count = pCore->ReadAudio(buffer, 64);
+        ringSamples.insert(ringSamples.end(), buffer, buffer + count);
+    }
+
+    // Verify
+    ASSERT_EQ(ringSamples, samples);
+    ASSERT_EQ(pCore->AudioOverflows(), 0);
+
+    // Act - let the ring buffer fill up, and then read more than it holds.
+    samples.clear();
+    pCore->RunUntil(pCore->Ticks() + 40000, stopNone, &samples);
+
+    word buffer[128];
+    size_t count = pCore->ReadAudio(buffer, 128);
+
+    // Verify - one slot is always left empty, so only 31 stereo samples fit.
+    ASSERT_EQ(count, 62);
+    ASSERT_EQ(wordvector(buffer, buffer + count), wordvector(samples.begin(), samples.begin() + count));
+    ASSERT_EQ(pCore->AudioOverflows(), samples.size() - 62);
+    ASSERT_EQ(pCore->AudioUnderflows(), 128 - 62 + (100 * 64 - ringSamples.size()));
+
+    // Act - remove the ring buffer.
+    pCore->SetAudioBuffer(nullptr, 0);
+    count = pCore->ReadAudio(buffer, 128);
+
+    // Verify
+    ASSERT_EQ(count, 0);
+    ASSERT_EQ(pCore->AudioOverflows(), 0);
+}
+
+// Ensures reading audio before a ring buffer has been set doesn't read anything.
+TEST(CoreTests, AudioRingBufferNone)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    word buffer[16];
+
+    // Act
+    size_t count = pCore->ReadAudio(buffer, 16);
+
+    // Verify
+    ASSERT_EQ(count, 0);
+    ASSERT_EQ(pCore->AudioUnderflows(), 0);
+}
+
+// Ensures that skipping frames doesn't affect the state of the core, and that each frame which is rendered matches
+// that of a core which renders every frame.
+TEST(CoreTests, FrameSkip)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    std::unique_ptr<Core> pSkipCore = std::make_unique<Core>();
+    LoadInterruptTestProgram(pCore.get());
+    LoadInterruptTestProgram(pSkipCore.get());
+    pCore->EnableLazyTicks(true);
+    pSkipCore->EnableLazyTicks(true);
+
+    qword frames = 0;
+    pSkipCore->SetFrameSkip(3);
+    pSkipCore->EnableFrameBuffers(true);
+    pSkipCore->SetFrameReadyCallback(CountFrame, &frames);
+
+    qword ticksEnd = pCore->Ticks() + 4000000;
+    int vSyncs = 0;
+
+    while (pCore->Ticks() < ticksEnd)
+    {
+        // Act
+        byte stopReason = pCore->RunUntil(ticksEnd, stopVSync, nullptr);
+        pSkipCore->RunUntil(ticksEnd, stopVSync, nullptr);
+
+        // Verify
+        ASSERT_EQ(CoreState(pCore.get()), CoreState(pSkipCore.get()));
+
+        if (stopReason != stopVSync)
+        {
+            break;
+        }
+
+        vSyncs++;
+
+        // Only the first of every three frames is rendered, and published at the VSync which ends it.
+        ASSERT_EQ((vSyncs + 2) / 3, frames);
+
+        if ((vSyncs % 3) == 1 && vSyncs > 1)
+        {
+            bytevector screen(pCore->GetScreen(nullptr, 0));
+            pCore->GetScreen(screen.data(), screen.size());
+
+            qword sequence = 0;
+            const byte* pFrame = pSkipCore->LatestFrame(sequence);
+
+            ASSERT_EQ(frames, sequence);
+            ASSERT_EQ(0, memcmp(screen.data(), pFrame, screen.size()));
+        }
+    }
+
+    ASSERT_GE(vSyncs, 49);
+}
+
+// Ensures that the lines reported as dirty at each VSync are exactly those which differ from the previous frame, when
+// only a single byte of screen memory is changing.
+TEST(CoreTests, DirtyLines)
+{
+    // Setup
+    bytevector program = {
+        0xF3,               // DI
+        0xED, 0x56,         // IM 1
+        0x31, 0x00, 0x80,   // LD SP,0x8000
+        0x01, 0x0F, 0x7F,   // LD BC,0x7F0F
+        0xED, 0x49,         // pens: OUT (C),C
+        0x79,               // LD A,C
+        0xF6, 0x40,         // OR 0x40
+        0xED, 0x79,         // OUT (C),A
+        0x0D,               // DEC C
+        0xF2, 0x09, 0x00,   // JP P,pens
+        0xFB,               // EI
+        0x76,               // loop: HALT
+        0x3C,               // INC A
+        0x32, 0x00, 0xC0,   // LD (0xC000),A
+        0x18, 0xF9          // JR loop
+    };
+
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    pCore->EnableLowerROM(false);
+    pCore->SetScreen(768, 288, 768);
+    pCore->EnableDirtyLines(true);
+
+    for (word addr = 0; addr < program.size(); addr++)
+    {
+        pCore->WriteRAM(addr, program[addr]);
+    }
+
+    pCore->WriteRAM(0x0038, 0xFB);  // EI
+    pCore->WriteRAM(0x0039, 0xC9);  // RET
+
+    qword ticksEnd = pCore->Ticks() + 2000000;
+    bytevector previousScreen(pCore->GetScreen(nullptr, 0));
+    int frames = 0;
+
+    while (pCore->Ticks() < ticksEnd)
+    {
+        // Act
+        if (pCore->RunUntil(ticksEnd, stopVSync, nullptr) != stopVSync)
+        {
+            break;
+        }
+
+        bytevector screen(pCore->GetScreen(nullptr, 0));
+        pCore->GetScreen(screen.data(), screen.size());
+        bytevector dirtyLines(pCore->GetDirtyLines(nullptr, 0));
+        pCore->GetDirtyLines(dirtyLines.data(), dirtyLines.size());
+
+        // Verify
+        ASSERT_EQ(288, dirtyLines.size());
+
+        int dirtyCount = 0;
+        for (size_t y = 0; y < dirtyLines.size(); y++)
+        {
+            bool changed = (memcmp(screen.data() + y * 768, previousScreen.data() + y * 768, 768) != 0);
+
+            // Until a couple of complete frames have been rendered, lines may be reported as dirty without having
+            // changed, but never the other way around.
+            if (frames >= 2)
+            {
+                ASSERT_EQ(changed ? 1 : 0, dirtyLines[y]);
+            }
+            else if (changed)
+            {
+                ASSERT_EQ(1, dirtyLines[y]);
+            }
+
+            dirtyCount += dirtyLines[y];
+        }
+
+        // Only the line showing the byte at 0xC000 should be changing.
+        if (frames >= 2)
+        {
+            ASSERT_EQ(1, dirtyCount);
+        }
+
+        previousScreen = screen;
+        frames++;
+    }
+
+    ASSERT_GE(frames, 20);
+}
+
+// Ensures that skipping over iterations of a VSync polling loop and a DJNZ delay loop, while taking interrupts, leaves
+// the core in the same state as executing every iteration.
+TEST(CoreTests, IdleSkip)
+{
+    // Setup
+    bytevector program = {
+        0xED, 0x56,         // IM 1
+        0x31, 0x00, 0xC0,   // LD SP,0xC000
+        0x21, 0x00, 0xC0,   // LD HL,0xC000
+        0x01, 0x82, 0xF7,   // LD BC,0xF782
+        0xED, 0x49,         // OUT (C),C
+        0xFB,               // EI
+        0x01, 0x00, 0xF5,   // loop: LD BC,0xF500
+        0xED, 0x78,         // vsync: IN A,(C)
+        0x1F,               // RRA
+        0x30, 0xFB,         // JR NC,vsync
+        0xED, 0x5F,         // LD A,R
+        0x77,               // LD (HL),A
+        0x2C,               // INC L
+        0x06, 0xC8,         // LD B,0xC8
+        0x10, 0xFE,         // delay: DJNZ delay
+        0x18, 0xEE          // JR loop
+    };
+
+    bytevector interruptHandler = {
+        0xF5,               // PUSH AF
+        0x78,               // LD A,B
+        0x32, 0x00, 0x40,   // LD (0x4000),A
+        0xF1,               // POP AF
+        0xFB,               // EI
+        0xC9                // RET
+    };
+
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    std::unique_ptr<Core> pIdleCore = std::make_unique<Core>();
+    for (Core* pC : { pCore.get(), pIdleCore.get() })
+    {
+        pC->EnableLowerROM(false);
+        pC->SetScreen(768, 288, 768);
+
+        for (word addr = 0; addr < program.size(); addr++)
+        {
+            pC->WriteRAM(addr, program[addr]);
+        }
+
+        for (word addr = 0; addr < interruptHandler.size(); addr++)
+        {
+            pC->WriteRAM(0x0038 + addr, interruptHandler[addr]);
+        }
+    }
+
+    // Act
+    pIdleCore->EnableIdleSkip(true);
+
+    // Verify
+    RunAndCompare(pCore.get(), pIdleCore.get());
+    ASSERT_GT(pIdleCore->IdleTicksSkipped(), 0);
+    ASSERT_EQ(pCore->IdleTicksSkipped(), 0);
+}
+
+// Loads a program that plays a tone on channel A at the given amplitude, then polls the PPI for a VSync and stores R
+// after each one.
+void LoadVSyncPollingProgram(Core* pCore, byte amplitude)
+{
+    bytevector program = {
+        0xF3,               // DI
+        0x01, 0x82, 0xF7,   // LD BC,0xF782
+        0xED, 0x49          // OUT (C),C
+    };
+
+    AppendPSGWrite(program, 0, 0x20);
+    AppendPSGWrite(program, 7, 0x3E);
+    AppendPSGWrite(program, 8, amplitude);
+
+    bytevector loop = {
+        0x21, 0x00, 0xC0,   // LD HL,0xC000
+        0x01, 0x00, 0xF5,   // loop: LD BC,0xF500
+        0xED, 0x78,         // vsync: IN A,(C)
+        0x1F,               // RRA
+        0x30, 0xFB,         // JR NC,vsync
+        0xED, 0x5F,         // LD A,R
+        0x77,               // LD (HL),A
+        0x2C,               // INC L
+        0xED, 0x78,         // novsync: IN A,(C)
+        0x1F,               // RRA
+        0x38, 0xFB,         // JR C,novsync
+        0x18, 0xED          // JR loop
+    };
+
+    program.insert(program.end(), loop.begin(), loop.end());
+
+    pCore->EnableLowerROM(false);
+    pCore->SetScreen(768, 288, 768);
+
+    for (word addr = 0; addr < program.size(); addr++)
+    {
+        pCore->WriteRAM(addr, program[addr]);
+    }
+}
+
+// Ensures that a tone playing while polling for a VSync doesn't limit how far ahead the polling loop can be skipped.
+TEST(CoreTests, IdleSkipWithTone)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    std::unique_ptr<Core> pIdleCore = std::make_unique<Core>();
+    std::unique_ptr<Core> pSilentCore = std::make_unique<Core>();
+    LoadVSyncPollingProgram(pCore.get(), 15);
+    LoadVSyncPollingProgram(pIdleCore.get(), 15);
+    LoadVSyncPollingProgram(pSilentCore.get(), 0);
+
+    // Act
+    pIdleCore->EnableIdleSkip(true);
+    pSilentCore->EnableIdleSkip(true);
+
+    qword ticksEnd = pSilentCore->Ticks() + 4000000;
+    while (pSilentCore->Ticks() < ticksEnd)
+    {
+        wordvector samples;
+        pSilentCore->RunUntil(ticksEnd, stopVSync, &samples);
+    }
+
+    // Verify
+    RunAndCompare(pCore.get(), pIdleCore.get());
+    ASSERT_GT(pIdleCore->IdleTicksSkipped(), 0);
+    ASSERT_EQ(pIdleCore->IdleTicksSkipped(), pSilentCore->IdleTicksSkipped());
+}
+
+// Ensures that skipping ahead while halted leaves the core in the same state as executing the HALT instruction
+// one microsecond at a time.
+TEST(CoreTests, SkipHalt)
+{
+    // Setup
+    bytevector program = {
+        0xED, 0x56,         // IM 1
+        0xFB,               // EI
+        0x76,               // halt: HALT
+        0x18, 0xFD          // JR halt
+    };
+
+    bytevector interruptHandler = {
+        0xED, 0x5F,         // LD A,R
+        0x32, 0x00, 0x40,   // LD (0x4000),A
+        0xFB,               // EI
+        0xC9                // RET
+    };
+
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    std::unique_ptr<Core> pSteppedCore = std::make_unique<Core>();
+    for (Core* pC : { pCore.get(), pSteppedCore.get() })
+    {
+        pC->EnableLowerROM(false);
+
+        for (word addr = 0; addr < program.size(); addr++)
+        {
+            pC->WriteRAM(addr, program[addr]);
+        }
+
+        for (word addr = 0; addr < interruptHandler.size(); addr++)
+        {
+            pC->WriteRAM(0x0038 + addr, interruptHandler[addr]);
+        }
+    }
+
+    qword ticksEnd = pCore->Ticks() + 400000;
+
+    // Act - running for a single tick ensures the stepped core never skips more than one HALT at a time.
+    pCore->RunUntil(ticksEnd, stopNone);
+    while (pSteppedCore->Ticks() < ticksEnd)
+    {
+        pSteppedCore->RunUntil(pSteppedCore->Ticks() + 1, stopNone);
+    }
+
+    // Verify
+    ASSERT_EQ(CoreState(pCore.get()), CoreState(pSteppedCore.get()));
+}
+
 TEST(CoreTests, KeyPress)
 {
     // Setup
@@ -250,6 +1275,266 @@ TEST(CoreTests, SaveAndLoadSnapshot)
     ASSERT_STRNE(c.str().c_str(), d.str().c_str());
 }
 
+// Ensures that reverting to any snapshot restores RAM, whether each page was last written to before or after it, and
+// including snapshots created after reverting to an earlier one.
+TEST(CoreTests, SnapshotRAM)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    std::mt19937 rng(0x5678);
+    std::vector<bytevector> states;
+
+    // Act
+    for (int id = 0; id < 40; id++)
+    {
+        if (id == 20)
+        {
+            pCore->RevertToSnapshot(10);
+        }
+
+        for (int w = 0; w < 20; w++)
+        {
+            pCore->WriteRAM((word)rng(), (byte)rng());
+        }
+
+        pCore->AF = (word)rng();
+
+        pCore->CreateSnapshot(id);
+        states.push_back(CoreState(pCore.get()));
+    }
+
+    // Verify
+    for (int id = 39; id >= 0; id -= 3)
+    {
+        pCore->RevertToSnapshot(id);
+        ASSERT_EQ(states[id], CoreState(pCore.get()));
+    }
+}
+
+// Ensures reverting never has to decode more diffs than the keyframe interval allows, whether keyframes are due to the
+// number of snapshots or the size of their diffs.
+TEST(CoreTests, SnapshotKeyframes)
+{
+    struct Policy
+    {
+        dword interval;
+        size_t diffBytes;
+        size_t maxDepths;
+    };
+
+    const Policy policies[] = {
+        { 0, 0, 40 },
+        { 5, 0x100000, 5 },
+        { 1000, 1, 2 }
+    };
+
+    for (const Policy& policy : policies)
+    {
+        // Setup
+        std::unique_ptr<Core> pCore = std::make_unique<Core>();
+        pCore->SetSnapshotKeyframes(policy.interval, policy.diffBytes);
+        std::mt19937 rng(0x9ABC);
+        std::vector<bytevector> states;
+
+        // Act
+        for (int id = 0; id < 40; id++)
+        {
+            for (int w = 0; w < 20; w++)
+            {
+                pCore->WriteRAM((word)rng(), (byte)rng());
+            }
+
+            pCore->CreateSnapshot(id);
+            states.push_back(CoreState(pCore.get()));
+        }
+
+        // Verify
+        size_t depths = pCore->GetSnapshotDepths(nullptr, 0);
+        ASSERT_EQ(depths, policy.maxDepths);
+
+        std::vector<dword> counts(depths);
+        pCore->GetSnapshotDepths(counts.data(), counts.size());
+        ASSERT_EQ(std::accumulate(counts.begin(), counts.end(), (dword)0), 40);
+
+        for (int id = 0; id < 40; id++)
+        {
+            pCore->RevertToSnapshot(id);
+            ASSERT_EQ(states[id], CoreState(pCore.get()));
+        }
+    }
+}
+
+// Ensures that deleting snapshots leaves every other one intact, whether it was stored as a diff against a deleted one
+// or relied on one for some of its RAM, and that deleted snapshots are actually freed.
+// The number of bytes held by a core's snapshots, computed from scratch.
+size_t SumSnapshotBytes(Core* pCore)
+{
+    size_t bytes = 0;
+    for (const std::pair<const int, std::shared_ptr<CoreSnapshot>>& kv : pCore->_newSnapshots)
+    {
+        bytes += kv.second->Bytes();
+    }
+
+    return bytes;
+}
+
+TEST(CoreTests, DeleteSnapshot)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    std::mt19937 rng(0x2468);
+    std::vector<bytevector> states;
+    std::vector<std::weak_ptr<CoreSnapshot>> snapshots;
+
+    for (int id = 0; id < 60; id++)
+    {
+        if (id == 30)
+        {
+            pCore->RevertToSnapshot(15);
+        }
+
+        for (int w = 0; w < 20; w++)
+        {
+            pCore->WriteRAM((word)rng(), (byte)rng());
+        }
+
+        pCore->AF = (word)rng();
+
+        pCore->CreateSnapshot(id);
+        states.push_back(CoreState(pCore.get()));
+        snapshots.push_back(pCore->_newSnapshots[id]);
+    }
+
+    // Act - deleting the snapshot most recently reverted to, and the one most recently created, ensures they're dealt
+    // with once they've been replaced.
+    std::set<int> deleted = { 15, 59 };
+    while (deleted.size() < 40)
+    {
+        deleted.insert(rng() % 60);
+    }
+
+    for (int id : deleted)
+    {
+        ASSERT_TRUE(pCore->DeleteSnapshot(id));
+        ASSERT_EQ(SumSnapshotBytes(pCore.get()), pCore->SnapshotBytes());
+    }
+
+    pCore->CreateSnapshot(60);
+    states.push_back(CoreState(pCore.get()));
+
+    // Verify
+    for (int id = 0; id <= 60; id++)
+    {
+        if (deleted.count(id) != 0)
+        {
+            ASSERT_FALSE(pCore->RevertToSnapshot(id));
+            ASSERT_TRUE(snapshots[id].expired());
+        }
+        else
+        {
+            ASSERT_TRUE(pCore->RevertToSnapshot(id));
+            ASSERT_EQ(states[id], CoreState(pCore.get()));
+        }
+
+        ASSERT_EQ(SumSnapshotBytes(pCore.get()), pCore->SnapshotBytes());
+    }
+}
+
+// Ensures that deleting the oldest snapshot, and then the snapshot after it, leaves the number of bytes held by the
+// snapshots consistent with those remaining, even while the first deleted is still being held on to (as it can be by
+// the core itself, or by another snapshot).
+TEST(CoreTests, DeleteOldestSnapshots)
+{
+    // Setup
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    std::mt19937 rng(0x1234);
+    std::map<int, bytevector> states;
+
+    // Changing a different register for each snapshot ensures that combining two diffs changes their size.
+    word* registers[] = { &pCore->AF, &pCore->BC, &pCore->DE, &pCore->HL, &pCore->IX, &pCore->IY };
+
+    for (int id = 0; id < 10; id++)
+    {
+        for (int w = 0; w < 20; w++)
+        {
+            pCore->WriteRAM((word)rng(), (byte)rng());
+        }
+
+        *registers[id % 6] = (word)rng();
+
+        pCore->CreateSnapshot(id);
+        states[id] = CoreState(pCore.get());
+    }
+
+    // As the first snapshot is a keyframe, it's the second which is the first to be deleted while being a diff.
+    std::shared_ptr<CoreSnapshot> pHeld = pCore->_newSnapshots[1];
+
+    // Act
+    for (int id = 0; id < 5; id++)
+    {
+        ASSERT_TRUE(pCore->DeleteSnapshot(id));
+
+        // Verify
+        ASSERT_EQ(SumSnapshotBytes(pCore.get()), pCore->SnapshotBytes());
+    }
+
+    for (int id = 5; id < 10; id++)
+    {
+        ASSERT_TRUE(pCore->RevertToSnapshot(id));
+        ASSERT_EQ(states[id], CoreState(pCore.get()));
+        ASSERT_EQ(SumSnapshotBytes(pCore.get()), pCore->SnapshotBytes());
+    }
+}
+
+// Ensures that snapshots are thinned out to keep within the budget, while every one from the last 10 seconds is kept
+// and all those remaining can still be reverted to.
+TEST(CoreTests, SnapshotBudget)
+{
+    // Setup
+    constexpr qword second = 4000000;
+    constexpr size_t budget = 0x80000;
+
+    std::unique_ptr<Core> pCore = std::make_unique<Core>();
+    pCore->SetSnapshotBudget(budget);
+    std::mt19937 rng(0x1357);
+    std::map<int, bytevector> states;
+    std::vector<qword> ticks;
+
+    // Act
+    for (int id = 0; id < 150; id++)
+    {
+        pCore->RunUntil(pCore->Ticks() + second / 2, stopNone);
+
+        for (int w = 0; w < 20; w++)
+        {
+            pCore->WriteRAM((word)rng(), (byte)rng());
+        }
+
+        pCore->CreateSnapshot(id);
+        states[id] = CoreState(pCore.get());
+        ticks.push_back(pCore->Ticks());
+
+        // Verify
+        ASSERT_LE(pCore->SnapshotBytes(), budget);
+        ASSERT_EQ(SumSnapshotBytes(pCore.get()), pCore->SnapshotBytes());
+    }
+
+    for (int id = 0; id < 150; id++)
+    {
+        if (pCore->Ticks() - ticks[id] < 10 * second)
+        {
+            ASSERT_TRUE(pCore->RevertToSnapshot(id));
+        }
+
+        if (pCore->RevertToSnapshot(id))
+        {
+            ASSERT_EQ(states[id], CoreState(pCore.get()));
+        }
+    }
+
+    ASSERT_LT(pCore->_newSnapshots.size(), 150);
+}
+
 // Ensures that for 8- and 16-bit registers declared in a "union/struct" fashion, the physical addresses
 // of each register is as expected (i.e. the physical address of the 16-bit register is the same as the
 // lower 8-bit register, and the upper 8-bit register immediately follows the lower). Adding this test as
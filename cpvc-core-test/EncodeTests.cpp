@@ -1,3 +1,5 @@
+#include <random>
+
 #include "gtest/gtest.h"
 #include "../cpvc-core/Core.h"
 #include "helpers.h"
@@ -30,3 +32,135 @@ TEST(EncodeTests, EncodeAndDecode)
     ASSERT_EQ(bytes.size(), decoded.size());
     ASSERT_EQ(0, memcmp(bytes.data(), decoded.data(), bytes.size()));
 };
+
+size_t ReadTestVarint(const bytevector& encoded, size_t& index)
+{
+    size_t value = 0;
+    for (int shift = 0; ; shift += 7)
+    {
+        byte b = encoded[index++];
+        value |= (size_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0)
+        {
+            return value;
+        }
+    }
+}
+
+// Ensures XOR encoding against a parent of any size decodes back to the original, with runs of zeroes that straddle,
+// fill or fall within SSE2 blocks, and that runs of xorMinRunLength zeroes or more are always encoded as runs.
+TEST(EncodeTests, XorEncodeAndDecode)
+{
+    std::mt19937 rng(0x1357);
+
+    for (size_t parentSize : { 0, 1, 15, 16, 1000, 1031, 4000 })
+    {
+        // Setup
+        bytevector bytes(1031);
+        bytevector parent(parentSize);
+        for (byte& b : parent)
+        {
+            b = (byte)rng();
+        }
+
+        size_t i = 0;
+        while (i < bytes.size())
+        {
+            // Alternate between bytes matching the parent, and bytes which differ from it.
+            size_t length = 1 + (rng() % 40);
+            bool same = (rng() % 2) == 0;
+            for (size_t j = i; j < std::min(i + length, bytes.size()); j++)
+            {
+                byte parentByte = (j < parentSize) ? parent[j] : 0;
+                bytes[j] = same ? parentByte : (byte)(parentByte ^ (1 + (rng() % 255)));
+            }
+
+            i += length;
+        }
+
+        bytevector encoded;
+        bytevector decoded;
+
+        // Act
+        XorRunLengthEncode(bytes.data(), bytes.size(), parent.data(), parent.size(), encoded);
+        RunLengthDecode(encoded, decoded);
+
+        // Verify
+        ASSERT_EQ(bytes.size(), decoded.size());
+        for (size_t j = 0; j < bytes.size(); j++)
+        {
+            byte parentByte = (j < parentSize) ? parent[j] : 0;
+            ASSERT_EQ(bytes[j], decoded[j] ^ parentByte);
+        }
+
+        ASSERT_EQ(encodeVersion2, encoded[0]);
+        size_t e = 1;
+        ASSERT_EQ(bytes.size(), ReadTestVarint(encoded, e));
+
+        while (e < encoded.size())
+        {
+            size_t header = ReadTestVarint(encoded, e);
+            size_t len = header >> 1;
+            if ((header & 1) == 0)
+            {
+                e += len;
+
+                // A literal can't contain a run of zeroes long enough to have been encoded as a run.
+                size_t literalZeroes = 0;
+                for (size_t k = e - len; k < e; k++)
+                {
+                    literalZeroes = (encoded[k] == 0) ? (literalZeroes + 1) : 0;
+                    ASSERT_LT(literalZeroes, xorMinRunLength);
+                }
+            }
+            else
+            {
+                ASSERT_GE(len, xorMinRunLength);
+            }
+        }
+    }
+}
+
+// Ensures streams in the original format, as would be held by blobs encoded before version 2, can still be decoded,
+// and that version 2 takes less space for a typical sparse diff.
+TEST(EncodeTests, DecodeOriginalFormat)
+{
+    // Setup
+    bytevector parent(0x10000);
+    for (size_t i = 0; i < parent.size(); i++)
+    {
+        parent[i] = (byte)(i * 37);
+    }
+
+    bytevector bytes = parent;
+    for (size_t i = 0; i < bytes.size(); i += 300)
+    {
+        bytes[i] ^= 0x01;
+        bytes[i + 1] ^= 0x80;
+    }
+
+    bytevector diff = bytes;
+    for (size_t i = 0; i < diff.size(); i++)
+    {
+        diff[i] ^= parent[i];
+    }
+
+    bytevector original;
+    RunLengthEncode(diff.data(), diff.size(), original);
+
+    bytevector version2;
+    XorRunLengthEncode(bytes.data(), bytes.size(), parent.data(), parent.size(), version2);
+
+    // Act
+    bytevector originalDecoded;
+    bytevector version2Decoded;
+    bool originalResult = RunLengthDecode(original, originalDecoded);
+    bool version2Result = RunLengthDecode(version2, version2Decoded);
+
+    // Verify
+    ASSERT_TRUE(originalResult);
+    ASSERT_TRUE(version2Result);
+    ASSERT_EQ(diff, originalDecoded);
+    ASSERT_EQ(diff, version2Decoded);
+    ASSERT_LT(version2.size() * 2, original.size());
+}
@@ -60,6 +60,113 @@ TEST(GateArrayTests, SelectPenAndColour)
     }
 }
 
+#ifdef GATEARRAY_SSSE3
+TEST(GateArrayTests, ExpandPixels)
+{
+    if (!GateArray::SSSE3Supported())
+    {
+        return;
+    }
+
+    // Setup
+    bool interruptRequested;
+    byte scanLineCount;
+    Memory memory;
+    std::unique_ptr<GateArray> pGateArray = std::make_unique<GateArray>(memory, interruptRequested, scanLineCount);
+
+    for (byte i = 0; i < 16; i++)
+    {
+        pGateArray->_pen[i] = 0x10 + i;
+    }
+
+    pGateArray->RenderPens();
+
+    for (byte mode : Range<byte>(0, 3))
+    {
+        pGateArray->_mode = mode;
+
+        for (word b : Range<word>(0x00, 0xFF))
+        {
+            // Act
+            byte b0 = (byte)b;
+            byte b1 = (byte)(b * 7);
+            byte pixels[16];
+            pGateArray->ExpandPixels(pixels, b0, b1, pGateArray->PenColours());
+
+            // Verify
+            ASSERT_EQ(0, memcmp(pixels, pGateArray->_renderedPenBytes[mode][b0], 8));
+            ASSERT_EQ(0, memcmp(pixels + 8, pGateArray->_renderedPenBytes[mode][b1], 8));
+        }
+    }
+}
+#endif
+
+TEST(GateArrayTests, RenderedPenBytes)
+{
+    // Setup
+    bool interruptRequested;
+    byte scanLineCount;
+    Memory memory;
+    std::unique_ptr<GateArray> pGateArray = std::make_unique<GateArray>(memory, interruptRequested, scanLineCount);
+    std::unique_ptr<GateArray> pExpectedGateArray = std::make_unique<GateArray>(memory, interruptRequested, scanLineCount);
+
+    for (byte p : Range<byte>(0x00, 0x0F))
+    {
+        for (byte c : { 0x03, 0x15, 0x1F })
+        {
+            // Act
+            pGateArray->Write(0x00 | p);
+            pGateArray->Write(0x40 | (byte)(c + p));
+
+            // Verify
+            pExpectedGateArray->_pen[p] = (byte)((c + p) & 0x1F);
+            pExpectedGateArray->RenderPens();
+
+            for (byte mode : Range<byte>(0, 3))
+            {
+                ASSERT_EQ(0, memcmp(pGateArray->RenderedPenBytes(mode), pExpectedGateArray->_renderedPenBytes[mode], sizeof(pGateArray->_renderedPenBytes[mode])));
+            }
+        }
+    }
+}
+
+TEST(GateArrayTests, RenderedPenBytesRewritten)
+{
+    // Setup
+    bool interruptRequested;
+    byte scanLineCount;
+    Memory memory;
+    std::unique_ptr<GateArray> pGateArray = std::make_unique<GateArray>(memory, interruptRequested, scanLineCount);
+
+    // Act - pen 5 can only appear in mode 0, where 16 values of each half of a byte select it for 4 pixels.
+    pGateArray->Write(0x05);
+    pGateArray->Write(0x4A);
+    pGateArray->Write(0x4A);
+    for (byte mode : Range<byte>(0, 3))
+    {
+        pGateArray->RenderedPenBytes(mode);
+    }
+
+    // Verify
+    ASSERT_EQ(128, pGateArray->_penBytesRewritten);
+
+    // Act
+    pGateArray->EndFrame();
+
+    // Verify
+    ASSERT_EQ(0, pGateArray->_penBytesRewritten);
+    ASSERT_EQ(128, pGateArray->_penBytesRewrittenLastFrame);
+
+#ifdef GATEARRAY_SSSE3
+    // Act - the pen colours are only counted the first time they're loaded after a change.
+    pGateArray->PenColours();
+    pGateArray->PenColours();
+
+    // Verify
+    ASSERT_EQ(16, pGateArray->_penBytesRewritten);
+#endif
+}
+
 TEST(GateArrayTests, Serialize)
 {
     // Setup
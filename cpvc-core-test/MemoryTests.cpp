@@ -219,3 +219,29 @@ TEST(MemoryTests, Reset)
     ASSERT_EQ(0x00, memory.Read(0x8000));
     ASSERT_EQ(0x02, memory.Read(0xc000));
 }
+
+// Ensures only the page written to is marked as dirty, taking into account which bank the RAM configuration maps the
+// address to.
+TEST(MemoryTests, DirtyPages)
+{
+    for (byte config = 0; config < 8; config++)
+    {
+        // Setup
+        Memory memory;
+        memory.SetRAMConfig(config);
+        memory.ClearDirtyPages();
+
+        // Act
+        memory.Write(0xC1FF, 0x01);
+
+        // Verify
+        byte bank = (config == 0 || config >= 4) ? 3 : 7;
+        word dirtyPage = bank * memPagesPerBank + 0x01;
+        for (word page = 0; page < memPageCount; page++)
+        {
+            ASSERT_EQ(page == dirtyPage, memory.PageDirty(page));
+        }
+
+        ASSERT_EQ(0x01, memory.Page(dirtyPage)[0xFF]);
+    }
+}
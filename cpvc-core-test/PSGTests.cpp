@@ -1,3 +1,5 @@
+#include <random>
+
 #include "gtest/gtest.h"
 #include "../cpvc-core/PSG.h"
 #include "helpers.h"
@@ -47,3 +49,77 @@ TEST(PSGTests, ReadRegister) {
         }
     }
 }
+
+bytevector PSGState(const PSG& psg)
+{
+    StreamWriter sw;
+    sw << psg;
+    bytevector state;
+    sw.CopyTo(state);
+
+    return state;
+}
+
+void WritePSGRegister(PSG& psg, byte reg, byte value)
+{
+    psg.SetControl(true, true);
+    psg.Write(reg);
+    psg.SetControl(true, false);
+    psg.Write(value);
+    psg.SetControl(false, false);
+}
+
+// Runs one PSG a microsecond at a time, and another from one event to the next (and in arbitrary chunks), through a
+// random sequence of register writes. The second PSG's amplitudes shouldn't change between events, and both should
+// always end up in the same state.
+TEST(PSGTests, TickToNextEvent) {
+    // Setup
+    Keyboard keyboard;
+    PSG reference(keyboard);
+    PSG psg(keyboard);
+    reference.Reset();
+    psg.Reset();
+
+    std::mt19937 rng(0x1234);
+    constexpr byte valueMasks[3] = { 0x03, 0x0F, 0xFF };
+
+    for (int w = 0; w < 2000; w++)
+    {
+        // Small periods are favoured, so that each generator wraps around plenty of times.
+        byte reg = rng() % 14;
+        byte value = rng() & valueMasks[rng() % 3];
+
+        WritePSGRegister(reference, reg, value);
+        WritePSGRegister(psg, reg, value);
+
+        dword ticks = 1 + (rng() % 2000);
+        dword maxChunk = ((rng() % 4) == 0) ? (1 + (rng() % 100)) : ticksNever;
+
+        // Act
+        while (ticks > 0)
+        {
+            dword chunk = std::min(std::min(psg.TicksToNextEvent(), maxChunk), ticks);
+            ASSERT_GT(chunk, 0);
+
+            byte amps[3];
+            psg.Amplitudes(amps);
+
+            for (dword t = 0; t < chunk; t++)
+            {
+                byte referenceAmps[3];
+                reference.Amplitudes(referenceAmps);
+                ASSERT_EQ(amps[0], referenceAmps[0]);
+                ASSERT_EQ(amps[1], referenceAmps[1]);
+                ASSERT_EQ(amps[2], referenceAmps[2]);
+
+                reference.Tick();
+            }
+
+            psg.Tick(chunk);
+            ticks -= chunk;
+        }
+
+        // Verify
+        ASSERT_EQ(PSGState(psg), PSGState(reference));
+    }
+}
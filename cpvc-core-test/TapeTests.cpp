@@ -463,3 +463,44 @@ TEST(TapeTests, ID20)
         }
     }
 }
+
+TEST(TapeTests, TickMultiple)
+{
+    // Setup
+    bytevector tapeBuffer = correctTapeHeader;
+    AddByte(tapeBuffer, 0x10);
+    AddWord(tapeBuffer, 1001);
+    AddWord(tapeBuffer, (word)testData.size());
+    tapeBuffer.insert(tapeBuffer.end(), testData.begin(), testData.end());
+
+    Tape tape;
+    tape.Load(tapeBuffer);
+    tape._motor = true;
+
+    Tape scheduledTape;
+    scheduledTape.Load(tapeBuffer);
+    scheduledTape._motor = true;
+
+    // Act and Verify
+    while (tape._playing)
+    {
+        dword ticks = scheduledTape.TicksToNextEvent();
+        ASSERT_NE(ticksNever, ticks);
+
+        // The tape's level should not change before the event it has scheduled.
+        for (dword t = 0; t < ticks - 1; t++)
+        {
+            bool level = tape._level;
+            tape.Tick();
+            ASSERT_EQ(level, tape._level);
+        }
+
+        tape.Tick();
+        scheduledTape.Tick(ticks);
+
+        ASSERT_EQ(tape._level, scheduledTape._level);
+        ASSERT_EQ(tape._playing, scheduledTape._playing);
+    }
+
+    ASSERT_EQ(ticksNever, scheduledTape.TicksToNextEvent());
+}
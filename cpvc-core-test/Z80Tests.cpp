@@ -2032,6 +2032,21 @@ TEST_F(Z80Tests, HALT)
     ASSERT_EQ(0x0002, _core.PC);
 }
 
+TEST_F(Z80Tests, HALTMultiple)
+{
+    // Setup
+    _core.Init();
+    _core.EnableLowerROM(false);
+    _core.EnableUpperROM(false);
+    SetMemory(0x0000, 0x76);
+
+    // Act - with interrupts disabled, this should execute HALT 1000 times.
+    _core.RunUntil(4000, stopNone);
+
+    // Verify
+    CommonChecks(_core.Ticks(), 4000, 0x0000, 1000 & 0x7F);
+}
+
 TEST_F(Z80Tests, LDrrnn)
 {
     LDrrnn(0x01, _core.BC);
@@ -3823,7 +3838,7 @@ TEST_F(Z80Tests, DAA)
 {
     for (byte f : testBytes)
     {
-        for (byte a : testBytes)
+        for (byte a : allBytes)
         {
             _core.Init();
             SetMemory(0x0000, 0x27);
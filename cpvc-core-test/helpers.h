@@ -45,3 +45,24 @@ static bytevector allBytes = Range<byte>(0x00, 0xFF);
 static bytevector testBytes = { 0x00, 0x0F, 0x55, 0xAA, 0xF0, 0xFF };
 static wordvector testAddresses = { 0x0000, 0x3FFF, 0x4000, 0x7FFF, 0x8000, 0xBFFF, 0xC000, 0xFFFF };
 static std::vector<offset> testOffsets = { 0, 127, -128 };
+
+// Appends instructions that write a value to one of the PSG's registers via the PPI, whose port A must be an output.
+inline void AppendPSGWrite(bytevector& program, byte reg, byte value)
+{
+    bytevector write = {
+        0x01, reg, 0xF4,    // LD BC,0xF400 + reg
+        0xED, 0x49,         // OUT (C),C
+        0x01, 0xC0, 0xF6,   // LD BC,0xF6C0
+        0xED, 0x49,         // OUT (C),C
+        0x01, 0x00, 0xF6,   // LD BC,0xF600
+        0xED, 0x49,         // OUT (C),C
+        0x01, value, 0xF4,  // LD BC,0xF400 + value
+        0xED, 0x49,         // OUT (C),C
+        0x01, 0x80, 0xF6,   // LD BC,0xF680
+        0xED, 0x49,         // OUT (C),C
+        0x01, 0x00, 0xF6,   // LD BC,0xF600
+        0xED, 0x49          // OUT (C),C
+    };
+
+    program.insert(program.end(), write.begin(), write.end());
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+
+#include "common.h"
+
+// A single producer, single consumer ring buffer of audio samples, held in memory provided by the caller. The
+// emulation thread writes samples as they're generated, and the audio device's callback reads them directly, without
+// either thread locking, allocating or waiting for the other. One slot is always left empty, so that a full buffer
+// can be told apart from an empty one.
+//
+// Note this is kept out of Core.h, as <atomic> can't be included when compiling with /clr.
+class AudioRingBuffer
+{
+public:
+    AudioRingBuffer(word* pBuffer, size_t size) :
+        _pBuffer(pBuffer), _size(size), _writeIndex(0), _readIndex(0), _overflows(0), _underflows(0)
+    {
+    }
+
+    ~AudioRingBuffer()
+    {
+    }
+
+    // Writes either all of the samples or, if there isn't room for them, none, so the channels of a stereo sample are
+    // never split. Samples which don't fit are counted as overflows.
+    bool Write(const word* pSamples, size_t count)
+    {
+        size_t writeIndex = _writeIndex.load(std::memory_order_relaxed);
+        size_t readIndex = _readIndex.load(std::memory_order_acquire);
+
+        size_t used = (writeIndex >= readIndex) ? (writeIndex - readIndex) : (_size - readIndex + writeIndex);
+        if (used + count >= _size)
+        {
+            _overflows.fetch_add(count, std::memory_order_relaxed);
+            return false;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            _pBuffer[writeIndex] = pSamples[i];
+            writeIndex++;
+            if (writeIndex == _size)
+            {
+                writeIndex = 0;
+            }
+        }
+
+        _writeIndex.store(writeIndex, std::memory_order_release);
+
+        return true;
+    }
+
+    // Reads up to count samples, and returns the number read. Any shortfall is counted as underflows.
+    size_t Read(word* pSamples, size_t count)
+    {
+        size_t readIndex = _readIndex.load(std::memory_order_relaxed);
+        size_t writeIndex = _writeIndex.load(std::memory_order_acquire);
+
+        size_t read = 0;
+        while (read < count && readIndex != writeIndex)
+        {
+            pSamples[read] = _pBuffer[readIndex];
+            read++;
+            readIndex++;
+            if (readIndex == _size)
+            {
+                readIndex = 0;
+            }
+        }
+
+        _readIndex.store(readIndex, std::memory_order_release);
+
+        if (read < count)
+        {
+            _underflows.fetch_add(count - read, std::memory_order_relaxed);
+        }
+
+        return read;
+    }
+
+    qword Overflows() const
+    {
+        return _overflows.load(std::memory_order_relaxed);
+    }
+
+    qword Underflows() const
+    {
+        return _underflows.load(std::memory_order_relaxed);
+    }
+
+private:
+    word* _pBuffer;
+    size_t _size;
+
+    // Only the producer stores _writeIndex and counts overflows, and only the consumer stores _readIndex and counts
+    // underflows.
+    std::atomic<size_t> _writeIndex;
+    std::atomic<size_t> _readIndex;
+    std::atomic<qword> _overflows;
+    std::atomic<qword> _underflows;
+};
@@ -40,32 +40,91 @@ public:
     {
         PopulateBytes();
 
-        bytevector diffBytes = *_pBytes;
         size_t parentSize = parentBlob->Size();
         byte* pParentData = parentBlob->Data();
 
-        size_t size = diffBytes.size();
-        if (parentSize < size)
+        _pEncodedDiffBytes = std::make_unique<bytevector>();
+        XorRunLengthEncode(_pBytes->data(), _pBytes->size(), pParentData, parentSize, *_pEncodedDiffBytes);
+        _parentBlob = parentBlob;
+        _pBytes->clear();
+
+        return std::move(_pBytes);
+    }
+
+    /// <summary>
+    /// Changes this Blob from a diff against its parent to a diff against its parent's parent, by combining the two
+    /// diffs, so the parent is no longer needed. If the parent is a full image, this Blob becomes one too.
+    /// </summary>
+    void SkipDiffParent()
+    {
+        std::shared_ptr<Blob> parentBlob = _parentBlob;
+        if (parentBlob == nullptr)
         {
-            size = parentSize;
+            return;
         }
 
-        byte* pDiffBytes = diffBytes.data();
-        byte* pParentBytes = pParentData;
-        for (size_t i = 0; i < size; i++)
+        if (parentBlob->_parentBlob != nullptr)
         {
-            *pDiffBytes ^= *pParentBytes;
+            bytevector diffBytes;
+            bytevector parentDiffBytes;
+            RunLengthDecode(*_pEncodedDiffBytes, diffBytes);
+            RunLengthDecode(*parentBlob->_pEncodedDiffBytes, parentDiffBytes);
+
+            // Where the two are the same size, XORing the diffs gives the diff against the parent's parent, regardless
+            // of its size. Otherwise (which is rare, as the size only changes when the screen or a disc does), fall
+            // back to populating this Blob from its parent.
+            if (diffBytes.size() == parentDiffBytes.size())
+            {
+                XorRunLengthEncode(
+                    diffBytes.data(), diffBytes.size(), parentDiffBytes.data(), parentDiffBytes.size(), *_pEncodedDiffBytes);
+                _parentBlob = parentBlob->_parentBlob;
 
-            pDiffBytes++;
-            pParentBytes++;
+                return;
+            }
         }
 
-        _pEncodedDiffBytes = std::make_unique<bytevector>();
-        RunLengthEncode(diffBytes.data(), _pBytes->size(), *_pEncodedDiffBytes);
-        _parentBlob = parentBlob;
-        _pBytes->clear();
+        PopulateBytes();
+    }
 
-        return std::move(_pBytes);
+    std::shared_ptr<Blob> DiffParent() const
+    {
+        return _parentBlob;
+    }
+
+    /// <summary>
+    /// Returns the number of bytes used to store this Blob, whether as a full image or a diff.
+    /// </summary>
+    size_t StoredSize() const
+    {
+        size_t size = (_pBytes != nullptr) ? _pBytes->size() : 0;
+        if (_pEncodedDiffBytes != nullptr)
+        {
+            size += _pEncodedDiffBytes->size();
+        }
+
+        return size;
+    }
+
+    /// <summary>
+    /// Returns the number of diffs which would need to be decoded in order to populate this Blob.
+    /// </summary>
+    size_t DiffDepth() const
+    {
+        size_t depth = 0;
+        for (const Blob* pBlob = this; pBlob->_parentBlob != nullptr; pBlob = pBlob->_parentBlob.get())
+        {
+            depth++;
+        }
+
+        return depth;
+    }
+
+    /// <summary>
+    /// Returns the size of the encoded diff, or 0 if this Blob is stored as a full image.
+    /// </summary>
+    size_t DiffSize() const
+    {
+        return (_parentBlob != nullptr) ? _pEncodedDiffBytes->size() : 0;
     }
 
     byte* Data()
@@ -255,6 +255,36 @@ void CRTC::Tick()
     }
 }
 
+dword CRTC::TicksToNextEvent() const
+{
+    // The memory address, along with the start and end of VSync, only change at the end of a scan line.
+    word lineLength = _horizontalTotal + 1;
+    dword ticks = (_hCount < lineLength) ? (lineLength - _hCount) : (256 - _hCount + lineLength);
+
+    // Interrupts can only be raised at the end of an HSync, and then only if the scan line count is about to
+    // reach 52 or the VSync delay is about to expire. Note that no more than two HSyncs can end before the end
+    // of the current scan line.
+    if (_scanLineCount >= 50 || (_vSyncDelay != 0 && _vSyncDelay <= 2))
+    {
+        dword hSyncEnd = 0;
+        if (_inHSync)
+        {
+            hSyncEnd = ((_horizontalAndVerticalSyncWidth - _hSyncCount - 1) & 0x0F) + 1;
+        }
+        else
+        {
+            hSyncEnd = ((_horizontalSyncPosition - _hCount - 1) & 0xFF) + 2;
+        }
+
+        if (hSyncEnd < ticks)
+        {
+            ticks = hSyncEnd;
+        }
+    }
+
+    return ticks;
+}
+
 StreamWriter& operator<<(StreamWriter& s, const CRTC& crtc)
 {
     s << crtc._x;
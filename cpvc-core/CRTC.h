@@ -17,6 +17,10 @@ public:
 
     void Tick();
 
+    // Returns a lower bound on the number of microseconds until the CRTC could next raise an interrupt, start or
+    // end a VSync, or change the address it reads screen memory from.
+    dword TicksToNextEvent() const;
+
     byte Read(word addr);
     void Write(word addr, byte b);
 
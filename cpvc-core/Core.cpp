@@ -1,5 +1,9 @@
+#include <limits>
+
 #include "Core.h"
 #include "CoreSnapshot.h"
+#include "FrameBuffers.h"
+#include "AudioRingBuffer.h"
 
 #include "Serialize.h"
 
@@ -48,7 +52,37 @@ void Core::Init()
     _scrHeight = 0;
     _scrWidth = 0;
 
+    _pScreenBuffer = nullptr;
+    _screenBufferPitch = 0;
+    _screenFormat = screenIndex8;
+
+    _pFrameBuffers.reset();
+    EnableDirtyLines(false);
+    _frameReadyCallback = nullptr;
+    _pFrameReadyContext = nullptr;
+
+    for (byte colour = 0; colour < 32; colour++)
+    {
+        dword rgb = hardwareColours[colour];
+        _rgb565Colours[colour] = (word)(((rgb >> 8) & 0xF800) | ((rgb >> 5) & 0x07E0) | ((rgb >> 3) & 0x001F));
+    }
+
     _pAudioSamples = nullptr;
+    _pAudioRingBuffer.reset();
+    _pAudioRing = nullptr;
+
+    StartVideoRun();
+
+    _pendingUs = 0;
+    _lazyHorizon = 0;
+    _lazyVideoPages = 0;
+
+    _idleTicksSkipped = 0;
+    _idleLoopClean = false;
+    _idleLoopPC = 0;
+    _idleLoopTicks = 0;
+    _idleLoopR = 0;
+    _idleLoopRegisters = {};
 
     _fdc.Init();
     _tape.Eject();
@@ -56,12 +90,21 @@ void Core::Init()
     _audioTickTotal = 0;
     _audioTicksToNextSample = 0;
     _audioSampleCount = 0;
+    InitAudioStep();
+
+    SetAudioFormat(audioAmplitudes);
 
     _lastSnapshotId = -1;
     _snapshots.clear();
 
     _newSnapshots.clear();
+    _snapshotTicks.clear();
+    _snapshotBytes = 0;
+    _thinnedTicks = 0;
     _lastSnapshot = nullptr;
+    _memorySnapshot = nullptr;
+    _snapshotsSinceKeyframe = 0;
+    _diffBytesSinceKeyframe = 0;
 }
 
 bool Core::KeyPress(byte keycode, bool down)
@@ -77,6 +120,16 @@ void Core::SetScreen(word pitch, word height, word width)
     _scrHeight = height;
 
     _screen.resize(static_cast<size_t>(height) * static_cast<size_t>(pitch));
+
+    if (!_lineHashes.empty())
+    {
+        EnableDirtyLines(true);
+    }
+
+    if (_pFrameBuffers != nullptr)
+    {
+        _pFrameBuffers = std::make_unique<FrameBuffers>(_screen.size());
+    }
 }
 
 void Core::SetScreen(byte* pBuffer, size_t size)
@@ -84,6 +137,64 @@ void Core::SetScreen(byte* pBuffer, size_t size)
     memcpy_s(_screen.data(), _screen.size(), pBuffer, size);
 }
 
+void Core::SetScreenBuffer(byte* pBuffer, size_t pitch, ScreenFormat format)
+{
+    _pScreenBuffer = pBuffer;
+    _screenBufferPitch = pitch;
+    _screenFormat = format;
+}
+
+void Core::EnableFrameBuffers(bool enabled)
+{
+    if (enabled)
+    {
+        _pFrameBuffers = std::make_unique<FrameBuffers>(_screen.size());
+    }
+    else
+    {
+        _pFrameBuffers.reset();
+    }
+}
+
+void Core::SetFrameReadyCallback(FrameReadyCallback callback, void* pContext)
+{
+    _frameReadyCallback = callback;
+    _pFrameReadyContext = pContext;
+}
+
+const byte* Core::LatestFrame(qword& sequence)
+{
+    if (_pFrameBuffers == nullptr)
+    {
+        sequence = 0;
+        return nullptr;
+    }
+
+    return _pFrameBuffers->Latest(sequence);
+}
+
+void Core::EnableDirtyLines(bool enabled)
+{
+    size_t lines = enabled ? _scrHeight : 0;
+
+    _lineHashes.assign(lines, 0);
+    _previousLineHashes.assign(lines, 0);
+    _dirtyLines.assign(lines, 0);
+}
+
+size_t Core::GetDirtyLines(byte* pBuffer, size_t size)
+{
+    if (pBuffer == nullptr)
+    {
+        return _dirtyLines.size();
+    }
+
+    size_t bytesToCopy = std::min(size, _dirtyLines.size());
+    memcpy(pBuffer, _dirtyLines.data(), bytesToCopy);
+
+    return bytesToCopy;
+}
+
 size_t Core::GetScreen(byte* pBuffer, size_t size)
 {
     if (pBuffer == nullptr)
@@ -99,30 +210,179 @@ size_t Core::GetScreen(byte* pBuffer, size_t size)
 
 void Core::SetFrequency(dword frequency)
 {
-    _frequency = frequency;
+    _frequency = (frequency != 0) ? frequency : 1;
     _audioSampleCount = 0;
     _audioTickTotal = 0;
     _audioTicksToNextSample = 0;
+
+    InitAudioStep();
+}
+
+void Core::SetAudioFormat(AudioFormat format)
+{
+    _audioFormat = format;
+    _audioLevels[0] = _audioLevels[1] = _audioLevels[2] = 0;
+    _audioLevelTicks = 0;
+}
+
+void Core::SetAudioBuffer(word* pBuffer, size_t size)
+{
+    if (pBuffer != nullptr)
+    {
+        _pAudioRingBuffer = std::make_unique<AudioRingBuffer>(pBuffer, size);
+    }
+    else
+    {
+        _pAudioRingBuffer.reset();
+    }
+}
+
+size_t Core::ReadAudio(word* pSamples, size_t count)
+{
+    return (_pAudioRingBuffer != nullptr) ? _pAudioRingBuffer->Read(pSamples, count) : 0;
+}
+
+qword Core::AudioOverflows() const
+{
+    return (_pAudioRingBuffer != nullptr) ? _pAudioRingBuffer->Overflows() : 0;
+}
+
+qword Core::AudioUnderflows() const
+{
+    return (_pAudioRingBuffer != nullptr) ? _pAudioRingBuffer->Underflows() : 0;
+}
+
+void Core::EnableLazyTicks(bool enabled)
+{
+    _lazyTicks = enabled;
+}
+
+void Core::EnableBlockExecution(bool enabled)
+{
+    _blockExecution = enabled;
+}
+
+void Core::EnableIdleSkip(bool enabled)
+{
+    _idleSkip = enabled;
+}
+
+qword Core::IdleTicksSkipped()
+{
+    return _idleTicksSkipped;
+}
+
+qword Core::PenBytesRewritten()
+{
+    return _gateArray._penBytesRewrittenLastFrame;
+}
+
+void Core::EnableHeadless(bool enabled)
+{
+    _headless = enabled;
+}
+
+void Core::EnableSSSE3Rendering(bool enabled)
+{
+    _ssse3Rendering = enabled && GateArray::SSSE3Supported();
+}
+
+void Core::SetFrameSkip(dword frames)
+{
+    _frameSkip = (frames == 0) ? 1 : frames;
+    _frameSkipCount = 0;
+    _skipFrame = false;
 }
 
 byte Core::RunUntil(qword stopTicks, byte stopReason, wordvector* pAudioSamples)
 {
-    _pAudioSamples = pAudioSamples;
+    // When headless, no samples are generated, though AudioRender still keeps track of when they're due.
+    _pAudioSamples = _headless ? nullptr : pAudioSamples;
+    _pAudioRing = _headless ? nullptr : _pAudioRingBuffer.get();
+
+    ScheduleDevices();
+    UpdateLazyHorizon();
+
+    // The keyboard, tape or memory may have been changed since the last call, so an iteration of an idle loop begun
+    // then can't be relied upon.
+    _idleLoopClean = false;
+
+    // Likewise, the CRTC may have been changed by a reset or by loading a snapshot.
+    StartVideoRun();
+
+    // Select the version of the main loop that only checks for the stop reasons and features in use, so these checks
+    // are made once per call rather than after every instruction.
+    typedef byte (Core::*RunLoopMethod)(qword);
+    static const RunLoopMethod runLoops[8] = {
+        &Core::RunLoop<false, false, false>,
+        &Core::RunLoop<false, false, true>,
+        &Core::RunLoop<false, true, false>,
+        &Core::RunLoop<false, true, true>,
+        &Core::RunLoop<true, false, false>,
+        &Core::RunLoop<true, false, true>,
+        &Core::RunLoop<true, true, false>,
+        &Core::RunLoop<true, true, true>
+    };
+
+    byte index =
+        (((stopReason & stopVSync) != 0) ? 0x04 : 0x00) |
+        (_blockExecution ? 0x02 : 0x00) |
+        (_idleSkip ? 0x01 : 0x00);
+
+    byte reason = (this->*runLoops[index])(stopTicks);
+
+    // Ensure all devices and the screen are up to date, as they may be inspected or serialized before the next call.
+    CatchUp();
+    SyncDevices();
+    VideoRender();
+
+    _pAudioSamples = nullptr;
+    _pAudioRing = nullptr;
+
+    return reason;
+}
 
+template<bool stopOnVSync, bool blockExecution, bool idleSkip>
+byte Core::RunLoop(qword stopTicks)
+{
     while (_ticks < stopTicks)
     {
-        bool vSyncBefore = _crtc._inVSync;
-        Step(stopReason);
+        if (_halted && _eiDelay == 0 && !(_iff1 && _interruptRequested) && (_ticks % 4) == 0)
+        {
+            if (SkipHalt(stopTicks, stopOnVSync ? stopVSync : stopNone))
+            {
+                return stopVSync;
+            }
+
+            continue;
+        }
+
+        if (blockExecution && _eiDelay == 0 && !(_iff1 && _interruptRequested))
+        {
+            if (ExecuteBlock<stopOnVSync, idleSkip>(stopTicks))
+            {
+                return stopVSync;
+            }
 
-        if ((stopReason & stopVSync) != 0 && !vSyncBefore && _crtc._inVSync)
+            continue;
+        }
+
+        bool vSyncBefore = stopOnVSync && _crtc._inVSync;
+        word pc = PC;
+        Step();
+
+        if (stopOnVSync && !vSyncBefore && _crtc._inVSync)
         {
             return stopVSync;
         }
-    }
 
-    _pAudioSamples = nullptr;
+        if (idleSkip)
+        {
+            SkipIdleLoop(pc, stopTicks);
+        }
+    }
 
-    return 0;
+    return stopNone;
 }
 
 // Rom methods
@@ -164,71 +424,393 @@ qword Core::Ticks()
 
 void Core::TickToNextMs()
 {
-    Tick((4 - (_ticks % 4)) % 4);
+    // Most memory accesses already fall on a microsecond boundary, so avoid a redundant call to Tick.
+    byte ticks = (4 - (_ticks % 4)) % 4;
+    if (ticks != 0)
+    {
+        Tick(ticks);
+    }
 }
 
 void Core::Tick(byte ticks)
 {
     byte usBoundaries = (ticks + (_ticks % 4)) / 4;
-    NonCPUTick(usBoundaries);
+    if (_lazyTicks)
+    {
+        _ticks += ticks;
+
+        _pendingUs += usBoundaries;
+        if (_pendingUs >= _lazyHorizon)
+        {
+            CatchUp();
+        }
+
+        return;
+    }
+
+    NonCPUTick(_ticks / 4, usBoundaries);
     _ticks += ticks;
 }
 
-void Core::NonCPUTick(byte ticks)
+void Core::IdleTick(dword us)
 {
-    for (byte t = 0; t < ticks; t++)
+    if (_lazyTicks)
     {
-        VideoRender();
-        AudioRender();
+        _ticks += 4 * (qword)us;
 
-        _crtc.Tick();
-        _psg.Tick();
-        _fdc.Tick();
-        _tape.Tick();
+        _pendingUs += us;
+        if (_pendingUs >= _lazyHorizon)
+        {
+            CatchUp();
+        }
+
+        return;
     }
+
+    NonCPUTick(_ticks / 4, us);
+    _ticks += 4 * (qword)us;
 }
 
-void Core::VideoRender()
+void Core::CatchUp()
 {
-    // Ensure the current x and y coordinates don't cause us to overrun the screen buffer.
-    if (_crtc._x >= _scrWidth || _crtc._y >= _scrHeight)
+    if (_pendingUs == 0)
     {
         return;
     }
 
-    bool inScreen = (_crtc._hCount < _crtc._horizontalDisplayed) && (_crtc._vCount < _crtc._verticalDisplay);
-    bool inSync = (_crtc._inHSync || _crtc._inVSync);
-    bool inBorder = !inScreen && !inSync;
+    // Note that _ticks has already been advanced past the pending microseconds.
+    NonCPUTick((_ticks / 4) - _pendingUs, _pendingUs);
+    _pendingUs = 0;
 
-    dword offset = (_scrPitch * _crtc._y) + _crtc._x * 16;
-    byte* pPixel = _screen.data() + offset;
+    UpdateLazyHorizon();
+}
 
-    if (inSync)
+void Core::UpdateLazyHorizon()
+{
+    if (!_lazyTicks)
     {
         return;
     }
 
-    if (inBorder)
+    _lazyHorizon = _crtc.TicksToNextEvent();
+
+    // Until the end of the scan line, the CRTC will read from no more than 256 bytes past its current address. When
+    // headless or skipping a frame, nothing is read at all.
+    word memAddr = _crtc._memoryAddress;
+    _lazyVideoPages = (_headless || _skipFrame) ? 0 : ((1 << ((memAddr >> 12) & 0x03)) | (1 << (((memAddr + 0x0100) >> 12) & 0x03)));
+}
+
+void Core::NonCPUTick(qword us, dword ticks)
+{
+    for (dword t = 0; t < ticks; t++)
     {
-        memset(pPixel, _gateArray._border, 16);
+        _videoRunLength++;
+        AudioRender();
+
+        _crtc.Tick();
+
+        // These are the only points at which the CRTC's position doesn't simply advance by one character.
+        if (_crtc._hCount == 0 || _crtc._inHSync != _videoRunInHSync)
+        {
+            VideoRender();
+        }
+
+        us++;
+        if (us >= _scheduler.Next())
+        {
+            RunScheduledDevices(us);
+        }
     }
-    else
+}
+
+void Core::ScheduleDevices()
+{
+    qword us = _ticks / 4;
+
+    _scheduler.Schedule(schedFDC, us, _fdc.TicksToNextEvent());
+    _scheduler.Schedule(schedTape, us, _tape.TicksToNextEvent());
+    _scheduler.Schedule(schedPSG, us, PSGTicksToNextEvent());
+}
+
+// The PSG only needs to be brought up to date at each change in its amplitudes while they're being sampled for audio.
+// Otherwise, nothing can see its tone, noise or envelope state, so it's left to catch up in bulk whenever the Z80
+// accesses it and at the end of RunUntil.
+dword Core::PSGTicksToNextEvent() const
+{
+    return (_pAudioSamples != nullptr || _pAudioRing != nullptr) ? _psg.TicksToNextEvent() : ticksNever;
+}
+
+// Brings a scheduled device up to date with the given microsecond.
+void Core::SyncDevice(ScheduledDevice device, qword us)
+{
+    dword ticks = (dword)(us - _scheduler.Synced(device));
+
+    switch (device)
+    {
+    case schedFDC:
+        _fdc.Tick(ticks);
+        _scheduler.Schedule(device, us, _fdc.TicksToNextEvent());
+        break;
+    case schedTape:
+        _tape.Tick(ticks);
+        _scheduler.Schedule(device, us, _tape.TicksToNextEvent());
+        break;
+    case schedPSG:
+        _psg.Tick(ticks);
+        _scheduler.Schedule(device, us, PSGTicksToNextEvent());
+        break;
+    default:
+        break;
+    }
+}
+
+void Core::SyncDevices()
+{
+    qword us = _ticks / 4;
+
+    SyncDevice(schedFDC, us);
+    SyncDevice(schedTape, us);
+    SyncDevice(schedPSG, us);
+}
+
+void Core::RunScheduledDevices(qword us)
+{
+    if (_scheduler.Deadline(schedFDC) <= us)
+    {
+        SyncDevice(schedFDC, us);
+    }
+
+    if (_scheduler.Deadline(schedTape) <= us)
+    {
+        SyncDevice(schedTape, us);
+    }
+
+    if (_scheduler.Deadline(schedPSG) <= us)
+    {
+        SyncDevice(schedPSG, us);
+    }
+}
+
+// Renders the characters in the current run, and starts a new one at the CRTC's current position.
+void Core::VideoRender()
+{
+    // Ensure the y coordinate doesn't cause us to overrun the screen buffer; the x coordinate is checked below.
+    if (_videoRunLength != 0 && !_videoRunInSync && !_headless && !_skipFrame && _videoRunY < _scrHeight)
+    {
+        if (_pScreenBuffer == nullptr)
+        {
+            byte* pScreen = (_pFrameBuffers != nullptr) ? _pFrameBuffers->Back() : _screen.data();
+
+            RenderVideoRun<byte>(pScreen + (_scrPitch * _videoRunY), nullptr);
+        }
+        else
+        {
+            byte* pLine = _pScreenBuffer + (_screenBufferPitch * _videoRunY);
+
+            switch (_screenFormat)
+            {
+            case screenIndex8:
+                RenderVideoRun<byte>(pLine, nullptr);
+                break;
+            case screenRGB565:
+                RenderVideoRun<word>(pLine, _rgb565Colours);
+                break;
+            case screenXRGB8888:
+                RenderVideoRun<dword>(pLine, hardwareColours);
+                break;
+            }
+        }
+    }
+
+    // A frame is complete at the start of VSync. Note the CRTC's VSync only ever starts at the beginning of a scan
+    // line, at which point we're always called.
+    if (_crtc._inVSync && !_videoRunInVSync)
     {
-        word memAddr = _crtc._memoryAddress + _crtc._hCount;
+        // A skipped frame isn't published, and leaves the line hashes alone, so the next frame rendered is compared
+        // against the last one which was.
+        if (!_skipFrame)
+        {
+            if (!_lineHashes.empty())
+            {
+                UpdateDirtyLines();
+            }
+
+            if (_pFrameBuffers != nullptr)
+            {
+                qword sequence = _pFrameBuffers->Publish();
+                if (_frameReadyCallback != nullptr)
+                {
+                    _frameReadyCallback(_pFrameReadyContext, sequence);
+                }
+            }
+        }
+
+        _gateArray.EndFrame();
+
+        _frameSkipCount = (_frameSkipCount + 1) % _frameSkip;
+        _skipFrame = (_frameSkipCount != 0);
+    }
+
+    StartVideoRun();
+}
+
+// Folds a value into the hash of a scan line's contents.
+inline qword HashLine(qword hash, qword value)
+{
+    hash = (hash ^ value) * 0x9E3779B97F4A7C15;
+
+    return hash ^ (hash >> 29);
+}
+
+// Compares the hash of each scan line in the frame just completed with that of the previous frame.
+void Core::UpdateDirtyLines()
+{
+    for (size_t y = 0; y < _lineHashes.size(); y++)
+    {
+        _dirtyLines[y] = (_lineHashes[y] != _previousLineHashes[y]) ? 1 : 0;
+    }
+
+    _previousLineHashes.swap(_lineHashes);
+    std::fill(_lineHashes.begin(), _lineHashes.end(), 0);
+}
+
+// Renders the characters in the current run to the given line of the screen. When T is a byte, the Gate Array's
+// hardware colours are written as they are; otherwise, pColours gives the pixel value for each hardware colour.
+template<typename T>
+void Core::RenderVideoRun(byte* pLine, const T* pColours)
+{
+    byte border = _gateArray._border;
+
+    // When rendering with SSSE3, the rendered pen bytes aren't needed, so don't bother bringing them up to date.
+    byte (&pens)[256][8] = _ssse3Rendering ?
+        _gateArray._renderedPenBytes[_gateArray._mode] :
+        _gateArray.RenderedPenBytes(_gateArray._mode);
+
+#ifdef GATEARRAY_SSSE3
+    __m128i colours = _ssse3Rendering ? _gateArray.PenColours() : _mm_setzero_si128();
+#endif
+
+    // If dirty lines are being tracked, the hardware colours of each character are folded into a hash of the line.
+    bool hashLine = !_lineHashes.empty();
+    qword lineHash = hashLine ? _lineHashes[_videoRunY] : 0;
+
+    for (word c = 0; c < _videoRunLength; c++)
+    {
+        byte x = (byte)(_videoRunX + c);
+        if (x >= _scrWidth)
+        {
+            continue;
+        }
+
+        byte hCount = (byte)(_videoRunHCount + c);
+        T* pPixel = ((T*)pLine) + x * 16;
+
+        if (!_videoRunVerticalDisplay || hCount >= _crtc._horizontalDisplayed)
+        {
+            if (sizeof(T) == 1)
+            {
+                memset(pPixel, border, 16);
+            }
+            else
+            {
+                std::fill(pPixel, pPixel + 16, pColours[border]);
+            }
+
+            if (hashLine)
+            {
+                lineHash = HashLine(HashLine(lineHash, x | 0x100), border);
+            }
+
+            continue;
+        }
+
+        word memAddr = _videoRunMemoryAddress + hCount;
         word addr = (word)
             (((memAddr & 0x3000) << 2) |
-             ((_crtc._raster & 0x07) << 11) |
+             ((_videoRunRaster & 0x07) << 11) |
              ((memAddr & 0x03FF) << 1));
 
-        byte (&pens)[256][8] = _gateArray._renderedPenBytes[_gateArray._mode];
+        byte b0 = _memory.VideoRead(addr);
+        byte b1 = _memory.VideoRead(addr + 1);
+
+        // Hardware colours can be written straight to the screen; otherwise they're converted from a temporary copy.
+        byte pixels[16];
+        byte* pHardwarePixels = (sizeof(T) == 1) ? (byte*)pPixel : pixels;
+
+#ifdef GATEARRAY_SSSE3
+        if (_ssse3Rendering)
+        {
+            _gateArray.ExpandPixels(pHardwarePixels, b0, b1, colours);
+        }
+        else
+#endif
+        {
+            memcpy(pHardwarePixels, pens[b0], 8);
+            memcpy(pHardwarePixels + 8, pens[b1], 8);
+        }
+
+        if (sizeof(T) != 1)
+        {
+            for (int p = 0; p < 16; p++)
+            {
+                pPixel[p] = pColours[pixels[p]];
+            }
+        }
+
+        if (hashLine)
+        {
+            qword pixels0;
+            qword pixels1;
+            memcpy(&pixels0, pHardwarePixels, 8);
+            memcpy(&pixels1, pHardwarePixels + 8, 8);
+
+            lineHash = HashLine(HashLine(HashLine(lineHash, x), pixels0), pixels1);
+        }
+    }
 
-        memcpy(pPixel, pens[_memory.VideoRead(addr)], 8);
-        memcpy(pPixel + 8, pens[_memory.VideoRead(addr + 1)], 8);
+    if (hashLine)
+    {
+        _lineHashes[_videoRunY] = lineHash;
+    }
+}
+
+void Core::StartVideoRun()
+{
+    _videoRunLength = 0;
+    _videoRunX = _crtc._x;
+    _videoRunY = _crtc._y;
+    _videoRunHCount = _crtc._hCount;
+    _videoRunMemoryAddress = _crtc._memoryAddress;
+    _videoRunRaster = _crtc._raster;
+    _videoRunVerticalDisplay = (_crtc._vCount < _crtc._verticalDisplay);
+    _videoRunInHSync = _crtc._inHSync;
+    _videoRunInSync = (_crtc._inHSync || _crtc._inVSync);
+    _videoRunInVSync = _crtc._inVSync;
+
+    // Until the end of the scan line, the CRTC will read from no more than 256 bytes past its current address.
+    word memAddr = _crtc._memoryAddress;
+    _videoRunPages = (1 << ((memAddr >> 12) & 0x03)) | (1 << (((memAddr + 0x0100) >> 12) & 0x03));
+    if (_headless || _skipFrame || _videoRunInSync)
+    {
+        _videoRunPages = 0;
     }
 }
 
 void Core::AudioRender()
 {
+    bool output = (_pAudioSamples != nullptr) || (_pAudioRing != nullptr);
+    bool pcm = (_audioFormat != audioAmplitudes) && output;
+    if (pcm)
+    {
+        byte amps[3];
+        AudioAmplitudes(amps);
+
+        _audioLevels[0] += ayLevels[amps[0]];
+        _audioLevels[1] += ayLevels[amps[1]];
+        _audioLevels[2] += ayLevels[amps[2]];
+        _audioLevelTicks++;
+    }
+
     if (_audioTickTotal >= _audioTicksToNextSample)
     {
         _audioSampleCount++;
@@ -236,35 +818,99 @@ void Core::AudioRender()
         {
             _audioSampleCount = 0;
             _audioTickTotal = 0;
+            _audioTicksToNextSample = 0;
+            _audioTicksRemainder = 0;
+        }
+        else
+        {
+            _audioTicksToNextSample += _audioTicksPerSample;
+            _audioTicksRemainder += _audioTicksPerSampleRemainder;
+            if (_audioTicksRemainder >= _frequency)
+            {
+                _audioTicksRemainder -= _frequency;
+                _audioTicksToNextSample++;
+            }
         }
 
-        double num = (((double)_audioSampleCount) * ((double) 1000000.0));
-        double denom = (double)_frequency;
-        _audioTicksToNextSample = (dword)(num / denom);
-
-        if (_pAudioSamples != nullptr)
+        if (pcm)
         {
-            byte amps[3];
-            _psg.Amplitudes(amps);
+            dword a = _audioLevels[0] / _audioLevelTicks;
+            dword b = _audioLevels[1] / _audioLevelTicks;
+            dword c = _audioLevels[2] / _audioLevelTicks;
 
-            if (_tape._motor && (_tape._level || _ppi._tapeWriteData))
+            if (_audioFormat == audioMono16)
+            {
+                word sample = (word)((int)(a + b + c) - audioMono16Midpoint);
+                WriteAudioSamples(&sample, 1);
+            }
+            else
             {
-                // If the tape level for either reading or writing is high, set the amplitudes to the maximum (15).
-                amps[0] = amps[1] = amps[2] = 15;
+                word samples[2] = {
+                    (word)((int)(a + b / 2) - audioStereo16Midpoint),
+                    (word)((int)(c + b / 2) - audioStereo16Midpoint)
+                };
+                WriteAudioSamples(samples, 2);
             }
 
+            _audioLevels[0] = _audioLevels[1] = _audioLevels[2] = 0;
+            _audioLevelTicks = 0;
+        }
+        else if (output)
+        {
+            byte amps[3];
+            AudioAmplitudes(amps);
+
             word sample =
                 (amps[0] & 0x0f) |
                 ((amps[1] & 0x0f) << 4) |
                 ((amps[2] & 0x0f) << 8);
 
-            _pAudioSamples->push_back(sample);
+            WriteAudioSamples(&sample, 1);
         }
     }
 
     _audioTickTotal++;
 }
 
+void Core::WriteAudioSamples(const word* pSamples, byte count)
+{
+    if (_pAudioSamples != nullptr)
+    {
+        _pAudioSamples->insert(_pAudioSamples->end(), pSamples, pSamples + count);
+    }
+
+    if (_pAudioRing != nullptr)
+    {
+        _pAudioRing->Write(pSamples, count);
+    }
+}
+
+void Core::AudioAmplitudes(byte (&amps)[3])
+{
+    _psg.Amplitudes(amps);
+
+    if (_tape._motor && (_tape._level || _ppi._tapeWriteData))
+    {
+        // If the tape level for either reading or writing is high, set the amplitudes to the maximum (15).
+        amps[0] = amps[1] = amps[2] = 15;
+    }
+}
+
+// Sets up the step between audio samples for the current frequency, along with the fractional part of the position of
+// the next sample.
+void Core::InitAudioStep()
+{
+    // Guard against a frequency of 0, which could still come from a snapshot.
+    if (_frequency == 0)
+    {
+        _frequency = 1;
+    }
+
+    _audioTicksPerSample = 1000000 / _frequency;
+    _audioTicksPerSampleRemainder = 1000000 % _frequency;
+    _audioTicksRemainder = (dword)((((qword)_audioSampleCount) * 1000000) % _frequency);
+}
+
 byte Core::BusRead(const word& addr)
 {
     return _pBus->Read(addr);
@@ -286,17 +932,62 @@ void Core::MemWriteRequest(word addr, byte b)
 {
     TickToNextMs();
 
+    // Writing a new value means the current iteration of an idle loop isn't one that can be repeated without effect.
+    if (_idleSkip && _memory.VideoRead(addr) != b)
+    {
+        _idleLoopClean = false;
+    }
+
+    // Ensure the CRTC doesn't see this write before it should.
+    if (_lazyTicks && (_lazyVideoPages & (1 << (addr >> 14))) != 0)
+    {
+        CatchUp();
+    }
+
+    if ((_videoRunPages & (1 << (addr >> 14))) != 0)
+    {
+        VideoRender();
+    }
+
     WriteRAM(addr, b);
 }
 
 byte Core::BusReadRequest(word addr)
 {
-    return BusRead(addr);
+    // Devices must be brought up to date before they can be accessed, and rescheduled afterwards, since
+    // the access may have changed when they next need attention.
+    CatchUp();
+    SyncDevices();
+
+    // Reading from the PPI has no side effects, and returns a value that only depends on the keyboard, the VSync and
+    // the tape, so is the only read permitted within an idle loop.
+    if (Bit(addr, 11) || _pBus != &_bus)
+    {
+        _idleLoopClean = false;
+    }
+
+    byte b = BusRead(addr);
+
+    ScheduleDevices();
+    UpdateLazyHorizon();
+
+    return b;
 }
 
 void Core::BusWriteRequest(word addr, byte b)
 {
+    CatchUp();
+    SyncDevices();
+
+    // The write may change the Gate Array's pens or mode, the CRTC's registers, or the RAM configuration.
+    VideoRender();
+
+    _idleLoopClean = false;
+
     BusWrite(addr, b);
+
+    ScheduleDevices();
+    UpdateLazyHorizon();
 }
 
 void Core::LoadTape(const byte* pBuffer, int size)
@@ -327,7 +1018,7 @@ void Core::LoadDisc(byte drive, const byte* pBuffer, int size)
     _fdc._drives[drive].Load(disk, buffer);
 }
 
-void Core::Step(byte stopReason)
+void Core::Step()
 {
     if (_eiDelay > 0)
     {
@@ -351,6 +1042,175 @@ void Core::Step(byte stopReason)
     Execute(op);
 }
 
+// Executes instructions until the Z80 has a pending EI or could accept an interrupt (at which point Step must
+// be used), or until stopTicks is reached. Returns true if execution stopped due to the start of a VSync.
+template<bool stopOnVSync, bool idleSkip>
+bool Core::ExecuteBlock(qword stopTicks)
+{
+    do
+    {
+        bool vSyncBefore = stopOnVSync && _crtc._inVSync;
+        word pc = PC;
+
+        byte op = MemReadRequest(PC++);
+        IncrementR();
+        Tick(4);
+
+        Execute(op);
+
+        if (stopOnVSync && !vSyncBefore && _crtc._inVSync)
+        {
+            return true;
+        }
+
+        if (idleSkip)
+        {
+            SkipIdleLoop(pc, stopTicks);
+        }
+    }
+    while (_ticks < stopTicks && _eiDelay == 0 && !(_iff1 && _interruptRequested));
+
+    return false;
+}
+
+// While halted, the Z80 repeatedly executes what amounts to a NOP, taking one microsecond each time, until an
+// interrupt is accepted. Rather than stepping through these one at a time, skip ahead in bulk to the next point at
+// which the CRTC could raise an interrupt or start a VSync, or to stopTicks. Returns true if execution stopped due to
+// the start of a VSync.
+bool Core::SkipHalt(qword stopTicks, byte stopReason)
+{
+    // Ensure the CRTC is up to date so we know how far ahead it's safe to skip.
+    CatchUp();
+
+    qword us = std::min<qword>((stopTicks - _ticks + 3) / 4, _crtc.TicksToNextEvent());
+
+    bool vSyncBefore = _crtc._inVSync;
+
+    IdleTick((dword)us);
+    R = (R & 0x80) | ((R + us) & 0x7F);
+
+    return ((stopReason & stopVSync) != 0) && !vSyncBefore && _crtc._inVSync;
+}
+
+// Returns true if the given opcode is an unprefixed JR, JP or DJNZ instruction.
+static bool IsJump(byte op)
+{
+    switch (op)
+    {
+    case 0x10:
+    case 0x18:
+    case 0x20:
+    case 0x28:
+    case 0x30:
+    case 0x38:
+    case 0xC2:
+    case 0xC3:
+    case 0xCA:
+    case 0xD2:
+    case 0xDA:
+    case 0xE2:
+    case 0xEA:
+    case 0xF2:
+    case 0xFA:
+        return true;
+    }
+
+    return false;
+}
+
+// The registers (other than R and PC) and interrupt state that an iteration of an idle loop must leave unchanged.
+std::array<word, 12> Core::IdleLoopRegisters()
+{
+    byte state =
+        (_iff1 ? 0x01 : 0x00) |
+        (_iff2 ? 0x02 : 0x00) |
+        (_interruptRequested ? 0x04 : 0x00) |
+        (_halted ? 0x08 : 0x00) |
+        ((_interruptMode & 0x03) << 4) |
+        ((_eiDelay & 0x03) << 6);
+
+    return { AF, BC, DE, HL, AF_, BC_, DE_, HL_, IX, IY, SP, MakeWord(I, state) };
+}
+
+void Core::StartIdleLoop()
+{
+    _idleLoopClean = true;
+    _idleLoopPC = PC;
+    _idleLoopTicks = _ticks;
+    _idleLoopR = R;
+    _idleLoopRegisters = IdleLoopRegisters();
+}
+
+// Called after each instruction executed by RunUntil, with the address it was fetched from. If the instruction was a
+// jump back to the start of the previous iteration of a loop, and that iteration left the registers as they were
+// (other than R, or B for a DJNZ to itself), didn't change memory, and only read from the PPI, then every subsequent
+// iteration will do exactly the same until the CRTC, tape or FDC do something. Skip over as many iterations as can
+// be completed before then.
+void Core::SkipIdleLoop(word pc, qword stopTicks)
+{
+    if (PC > pc || !IsJump(_memory.Read(pc)))
+    {
+        return;
+    }
+
+    if (PC != _idleLoopPC || _ticks >= stopTicks)
+    {
+        StartIdleLoop();
+        return;
+    }
+
+    bool djnz = (PC == pc && _memory.Read(pc) == 0x10);
+
+    std::array<word, 12> registers = IdleLoopRegisters();
+    if (djnz)
+    {
+        registers[1] += 0x0100;
+    }
+
+    qword ticks = _ticks - _idleLoopTicks;
+    if (!_idleLoopClean || registers != _idleLoopRegisters || (ticks % 4) != 0)
+    {
+        StartIdleLoop();
+        return;
+    }
+
+    // Ensure the CRTC is up to date so we know how far ahead it's safe to skip. The last skipped iteration must end
+    // before the microsecond in which the CRTC, tape or FDC could next change anything the loop can see. The PSG's
+    // tone, noise and envelope state can't be seen by the loop, so any of its events are simply handled by IdleTick.
+    CatchUp();
+
+    qword us = _crtc.TicksToNextEvent();
+    qword now = _ticks / 4;
+    qword next = std::min(_scheduler.Deadline(schedFDC), _scheduler.Deadline(schedTape));
+    if (next - now < us)
+    {
+        us = (next > now) ? (next - now) : 0;
+    }
+
+    qword iterations = (us > 0) ? ((us - 1) / (ticks / 4)) : 0;
+    iterations = std::min<qword>(iterations, (stopTicks - _ticks) / ticks);
+    if (djnz)
+    {
+        iterations = std::min<qword>(iterations, B - 1);
+    }
+
+    if (iterations > 0)
+    {
+        byte rIncrement = (R - _idleLoopR) & 0x7F;
+
+        IdleTick((dword)(iterations * (ticks / 4)));
+        R = (R & 0x80) | ((R + iterations * rIncrement) & 0x7F);
+        if (djnz)
+        {
+            B -= (byte)iterations;
+        }
+
+        _idleTicksSkipped += iterations * ticks;
+    }
+
+    StartIdleLoop();
+}
+
 void Core::Execute(byte op)
 {
     switch (op)
@@ -1486,6 +2346,9 @@ bool Core::HandleInterrupt()
 {
     if (_iff1 && _interruptRequested)
     {
+        // Acknowledging the interrupt modifies the CRTC's scan line count.
+        CatchUp();
+
         if (_halted)
         {
             PC++;
@@ -1498,6 +2361,8 @@ bool Core::HandleInterrupt()
 
         _crtc._scanLineCount &= 0xDF;
 
+        _idleLoopClean = false;
+
         IncrementR();
 
         switch (_interruptMode)
@@ -1585,6 +2450,8 @@ StreamReader& operator>>(StreamReader& s, Core& core)
     s >> core._audioSampleCount;
     s >> core._frequency;
 
+    core.InitAudioStep();
+
     return s;
 }
 
@@ -1622,17 +2489,206 @@ std::ostringstream& operator<<(std::ostringstream& s, const Core& core)
     return s;
 }
 
+constexpr qword snapshotSecond = 4000000;
+
 void Core::CreateSnapshot(int id)
 {
-    std::shared_ptr<CoreSnapshot> currentSnapshot = std::make_shared<CoreSnapshot>(*this, _lastSnapshot);
+    DeleteSnapshot(id);
+
+    // Making the last snapshot's core a diff against this one's changes its size.
+    bool diffLast = (_lastSnapshot != nullptr && !_lastSnapshot->_deleted);
+    size_t lastBytes = diffLast ? _lastSnapshot->Bytes() : 0;
+
+    bool keyframe = (_lastSnapshot == nullptr);
+    if (_keyframeInterval != 0)
+    {
+        keyframe |= (_snapshotsSinceKeyframe + 1 >= _keyframeInterval) || (_diffBytesSinceKeyframe >= _keyframeDiffBytes);
+
+        // After reverting, RAM's pages may be part of a different chain to the rest of the core.
+        if (_memorySnapshot != nullptr)
+        {
+            keyframe |=
+                (_memorySnapshot->PageDepth() + 1 >= _keyframeInterval) ||
+                (_memorySnapshot->PageChainBytes() >= _keyframeDiffBytes);
+        }
+    }
+
+    std::shared_ptr<CoreSnapshot> currentSnapshot = std::make_shared<CoreSnapshot>(*this, _lastSnapshot, keyframe);
+    currentSnapshot->_ticks = _ticks;
+    currentSnapshot->StorePages(_memory, _memorySnapshot);
+
+    if (currentSnapshot->_memoryParent != nullptr)
+    {
+        // A deleted snapshot is only kept until it's been replaced as the one RAM's dirty pages are relative to.
+        if (currentSnapshot->_memoryParent->_deleted)
+        {
+            currentSnapshot->SkipMemoryParent();
+        }
+
+        if (currentSnapshot->_memoryParent != nullptr)
+        {
+            currentSnapshot->_memoryParent->AddMemoryChild(currentSnapshot);
+        }
+    }
+
+    if (_lastSnapshot != nullptr && _lastSnapshot->_coreStuff->DiffParent() == currentSnapshot->_coreStuff)
+    {
+        _lastSnapshot->_newerDiff = currentSnapshot;
+        currentSnapshot->_olderDiff = _lastSnapshot;
+    }
+
+    if (diffLast)
+    {
+        _snapshotBytes += _lastSnapshot->Bytes();
+        _snapshotBytes -= lastBytes;
+    }
+
+    if (keyframe)
+    {
+        _snapshotsSinceKeyframe = 0;
+        _diffBytesSinceKeyframe = 0;
+    }
+    else
+    {
+        _snapshotsSinceKeyframe++;
+        _diffBytesSinceKeyframe += _lastSnapshot->_coreStuff->DiffSize();
+    }
 
     _newSnapshots[id] = currentSnapshot;    
+    _snapshotTicks.insert(std::make_pair(_ticks, id));
+    _snapshotBytes += currentSnapshot->Bytes();
     _lastSnapshot = currentSnapshot;
+    _memorySnapshot = currentSnapshot;
+
+    // A snapshot taken after reverting may be older than the last thinning pass, so make sure the next pass covers it.
+    _thinnedTicks = std::min(_thinnedTicks, _ticks);
+
+    if (_snapshotBudget != 0)
+    {
+        ThinSnapshots();
+    }
+}
+
+void Core::SetSnapshotBudget(size_t bytes)
+{
+    _snapshotBudget = bytes;
+}
+
+size_t Core::SnapshotBytes() const
+{
+    return _snapshotBytes;
+}
+
+// Snapshots are thinned out in tiers by age. All those from the last 10 seconds are kept, those from the last minute
+// are kept 10 frames apart, and beyond that, each doubling in age doubles the spacing, so the number kept only grows
+// with the logarithm of the length of the session. As a snapshot's spacing only changes when it crosses into an older
+// tier, each pass only has to check those which have done so since the last one.
+void Core::ThinSnapshots()
+{
+    if (_snapshotBytes <= _snapshotBudget)
+    {
+        return;
+    }
+
+    int64_t thinned = (int64_t)_thinnedTicks;
+    int64_t now = (int64_t)_ticks;
+
+    ThinSnapshots(thinned - 10 * snapshotSecond, now - 10 * snapshotSecond, snapshotSecond / 5);
+    for (qword age = 60 * snapshotSecond; age <= _ticks; age *= 2)
+    {
+        ThinSnapshots(thinned - (int64_t)age, now - (int64_t)age, age / 8);
+    }
+
+    _thinnedTicks = _ticks;
+
+    // If that's still not enough, evict the oldest, though always keeping the newest.
+    while (_snapshotBytes > _snapshotBudget && _snapshotTicks.size() > 1)
+    {
+        EvictSnapshot(_snapshotTicks.begin()->second);
+    }
+}
+
+// Goes through the snapshots taken after from and no later than to, from newest to oldest, deleting those less than
+// spacing ticks older than the next snapshot.
+void Core::ThinSnapshots(int64_t from, int64_t to, qword spacing)
+{
+    if (to < 0 || to <= from)
+    {
+        return;
+    }
+
+    auto newer = _snapshotTicks.upper_bound(std::make_pair((qword)to, std::numeric_limits<int>::max()));
+    while (newer != _snapshotTicks.begin())
+    {
+        auto snapshot = std::prev(newer);
+        if ((int64_t)snapshot->first <= from)
+        {
+            break;
+        }
+
+        if (newer != _snapshotTicks.end() && newer->first - snapshot->first < spacing)
+        {
+            EvictSnapshot(snapshot->second);
+        }
+        else
+        {
+            newer = snapshot;
+        }
+    }
+}
+
+void Core::SetSnapshotKeyframes(dword interval, size_t diffBytes)
+{
+    _keyframeInterval = interval;
+    _keyframeDiffBytes = diffBytes;
+}
+
+size_t Core::GetSnapshotDepths(dword* pCounts, size_t size)
+{
+    std::vector<dword> counts;
+    for (const std::pair<const int, std::shared_ptr<CoreSnapshot>>& kv : _newSnapshots)
+    {
+        size_t depth = std::max(kv.second->_coreStuff->DiffDepth(), (size_t)kv.second->PageDepth());
+        if (depth >= counts.size())
+        {
+            counts.resize(depth + 1, 0);
+        }
+
+        counts[depth]++;
+    }
+
+    if (pCounts == nullptr)
+    {
+        return counts.size();
+    }
+
+    size_t countsToCopy = std::min(size, counts.size());
+    memcpy(pCounts, counts.data(), countsToCopy * sizeof(dword));
+
+    return countsToCopy;
 }
 
 bool Core::DeleteSnapshot(int id)
 {
-    return _newSnapshots.erase(id) != 0;
+    if (_newSnapshots.find(id) == _newSnapshots.end())
+    {
+        return false;
+    }
+
+    EvictSnapshot(id);
+
+    return true;
+}
+
+// Removes a snapshot, re-parenting any others which depend on it, and updates the number of bytes held by snapshots.
+void Core::EvictSnapshot(int id)
+{
+    std::shared_ptr<CoreSnapshot> snapshot = _newSnapshots[id];
+    _newSnapshots.erase(id);
+    _snapshotTicks.erase(std::make_pair(snapshot->_ticks, id));
+
+    int64_t bytesChange = snapshot->Unlink() - (int64_t)snapshot->Bytes();
+    _snapshotBytes = (size_t)((int64_t)_snapshotBytes + bytesChange);
 }
 
 bool Core::RevertToSnapshot(int id)
@@ -1644,7 +2700,14 @@ bool Core::RevertToSnapshot(int id)
 
     CoreSnapshot& snapshot = *(_newSnapshots[id].get());
 
+    // Decoding the snapshot's core turns those it's a diff against back into full images.
+    size_t chainBytes = snapshot.DiffChainBytes();
     Serialize::Read(*snapshot._coreStuff, *this);
+    _snapshotBytes += snapshot.DiffChainBytes();
+    _snapshotBytes -= chainBytes;
+
+    snapshot.RestorePages(_memory);
+    _memorySnapshot = _newSnapshots[id];
 
     return true;
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <set>
+
 #include "common.h"
 
 #include "Memory.h"
@@ -12,23 +14,41 @@
 #include "CRTC.h"
 #include "Bus.h"
 #include "IBus.h"
+#include "Scheduler.h"
+#include "FlagTables.h"
 
 struct CoreSnapshot;
-
-// Z80 flags
-constexpr byte flagS = 0x80;     // Sign flag
-constexpr byte flagZ = 0x40;     // Zero flag
-constexpr byte flag5 = 0x20;     // Undocumented bit 5 flag
-constexpr byte flagH = 0x10;     // Half-carry flag
-constexpr byte flag3 = 0x08;     // Undocumented bit 3 flag
-constexpr byte flagPV = 0x04;    // Parity/Overflow flag
-constexpr byte flagN = 0x02;     // Add/Subtract flag
-constexpr byte flagC = 0x01;     // Carry flag
+class FrameBuffers;
+class AudioRingBuffer;
 
 // Bitmask for conditions to stop execution in RunUntil.
 constexpr byte stopNone = 0x00;
 constexpr byte stopVSync = 0x02;
 
+// Pixel formats the screen can be rendered in.
+enum ScreenFormat
+{
+    screenIndex8,       // One byte per pixel, giving the Gate Array's hardware colour.
+    screenRGB565,       // Two bytes per pixel.
+    screenXRGB8888      // Four bytes per pixel, as 0x00RRGGBB.
+};
+
+// Formats of the audio samples generated by RunUntil.
+enum AudioFormat
+{
+    audioAmplitudes,    // One word per sample, with each channel's 4 bit amplitude packed into bits 0-3, 4-7 and 8-11.
+    audioMono16,        // One signed 16 bit sample per sample, mixing all three channels.
+    audioStereo16       // Two signed 16 bit samples (left then right) per sample, with channel B in the centre.
+};
+
+// The channel levels are all positive, so PCM samples are centred on zero by subtracting the midpoint of their range.
+// A mono sample sums all three channels, while each stereo sample sums one channel and half of channel B.
+constexpr int audioMono16Midpoint = (3 * ayLevels[15]) / 2;
+constexpr int audioStereo16Midpoint = (ayLevels[15] + ayLevels[15] / 2) / 2;
+
+// Called from within RunUntil when a frame has been published by a core with frame buffers enabled.
+typedef void (*FrameReadyCallback)(void* pContext, qword sequence);
+
 // Class representing the CPC's hardware.
 class Core
 {
@@ -44,10 +64,28 @@ public:
     std::shared_ptr<CoreSnapshot> _lastSnapshot;
     std::shared_ptr<CoreSnapshot> _currentSnapshot;
 
+    // The snapshot most recently created or reverted to, which RAM's dirty pages are relative to.
+    std::shared_ptr<CoreSnapshot> _memorySnapshot;
+
     void CreateSnapshot(int id);
     bool DeleteSnapshot(int id);
     bool RevertToSnapshot(int id);
 
+    // Snapshots are mostly stored as diffs, with a keyframe stored in full whenever the given number of snapshots, or
+    // the given number of bytes of diffs, have been stored since the last one. Reverting to a snapshot then never has
+    // to decode more than that many diffs. An interval of 0 disables keyframes.
+    void SetSnapshotKeyframes(dword interval, size_t diffBytes);
+
+    // Copies the number of snapshots for which reverting would have to decode 0, 1, 2 (and so on) diffs. Passing
+    // nullptr returns the number of entries.
+    size_t GetSnapshotDepths(dword* pCounts, size_t size);
+
+    // Limits the number of bytes held by snapshots. When creating a snapshot takes them over the limit, older ones are
+    // thinned out, keeping every snapshot from the last 10 seconds, every 10th from the last minute, and increasingly
+    // fewer beyond that, after which the oldest are deleted. A limit of 0 keeps every snapshot.
+    void SetSnapshotBudget(size_t bytes);
+    size_t SnapshotBytes() const;
+
     void Init();
     void Reset();
     bool KeyPress(byte keycode, bool down);
@@ -58,8 +96,97 @@ public:
     void SetScreen(byte* pBuffer, size_t size);
     size_t GetScreen(byte* pBuffer, size_t size);
 
+    // Renders the screen directly into the given buffer, in the given format, rather than into the core's own screen
+    // buffer. The buffer must have room for the height and width given to SetScreen, with pitch bytes between the
+    // start of each line, and remain valid until replaced. Passing nullptr goes back to using the core's own buffer.
+    // Note that GetScreen and SetScreen, along with the core's serialized state, only ever refer to the core's own
+    // buffer, which isn't updated while a caller's buffer is in use.
+    void SetScreenBuffer(byte* pBuffer, size_t pitch, ScreenFormat format);
+
+    // When enabled, the core renders into one of three frame buffers of its own, each the size given to SetScreen,
+    // and publishes it as the latest frame at the start of every VSync. A presenter thread can then call LatestFrame
+    // at any time, without any locking or copying, even while RunUntil is executing on another thread. As with
+    // SetScreenBuffer, the core's own screen buffer isn't updated while frame buffers are enabled.
+    void EnableFrameBuffers(bool enabled);
+
+    // Sets a function to be called on the emulation thread whenever a frame is published.
+    void SetFrameReadyCallback(FrameReadyCallback callback, void* pContext);
+
+    // Returns the most recently published frame, along with its sequence number (the number of frames published
+    // before and including it). The frame remains valid, and is not written to, until the next call to LatestFrame.
+    // If frame buffers aren't enabled, nullptr is returned with a sequence number of 0. Only a single thread should
+    // call this, and as disabling frame buffers frees them, not while they're being enabled or disabled.
+    const byte* LatestFrame(qword& sequence);
+
+    // When enabled, a hash of each scan line is computed as it's rendered, and at the start of each VSync, compared
+    // with the previous frame's, so that callers only need to update or transfer the lines which have changed.
+    void EnableDirtyLines(bool enabled);
+
+    // Copies a byte for each scan line of the screen, which is 1 if the line differed from that of the previous frame
+    // in the last frame completed, or 0 otherwise. Passing nullptr returns the number of lines.
+    size_t GetDirtyLines(byte* pBuffer, size_t size);
+
+    // Sets the number of audio samples generated per second. A frequency of 0 is treated as 1.
     void SetFrequency(dword frequency);
 
+    // Sets the format of the samples RunUntil generates. For the 16 bit formats, the level of each channel (given by
+    // the AY's logarithmic volume table) is averaged over every microsecond since the previous sample, rather than
+    // only being sampled at one point, which greatly reduces aliasing.
+    void SetAudioFormat(AudioFormat format);
+
+    // Has RunUntil write samples into a ring buffer held in the given memory, of size words, as well as into any
+    // vector passed to it. The audio device's callback can then call ReadAudio at any time, without locking, even
+    // while RunUntil is executing on another thread. Samples that don't fit are dropped. The memory must remain valid
+    // until replaced, and passing nullptr stops using a ring buffer. As this frees the previous ring buffer, it must
+    // only be called while nothing is calling ReadAudio, for example before starting or after stopping the device.
+    void SetAudioBuffer(word* pBuffer, size_t size);
+
+    // Reads up to count samples from the ring buffer, returning the number read, or 0 if there's no ring buffer. Only a
+    // single thread should call this.
+    size_t ReadAudio(word* pSamples, size_t count);
+
+    // The number of samples dropped due to the ring buffer being full, and the number requested by ReadAudio when it
+    // was empty.
+    qword AudioOverflows() const;
+    qword AudioUnderflows() const;
+
+    // When enabled, the CRTC, Gate Array, PSG and other non-Z80 hardware are not ticked every microsecond, but are
+    // instead brought up to date in bulk whenever the Z80 accesses them, when the CRTC could next raise an interrupt
+    // or change what it displays, and at the end of RunUntil.
+    void EnableLazyTicks(bool enabled);
+
+    // When enabled, RunUntil executes runs of instructions back to back, only returning to Step's checks for a
+    // pending EI or an acceptable interrupt when the Z80's state means one of them could apply.
+    void EnableBlockExecution(bool enabled);
+
+    // When enabled, RunUntil looks for loops whose iterations leave the Z80, memory and other hardware exactly as they
+    // were (such as polling the PPI for a VSync, waiting for a key press or a DJNZ delay), and skips ahead over as many
+    // iterations as it can before anything the loop depends on could change.
+    void EnableIdleSkip(bool enabled);
+
+    // The total number of ticks skipped over by idle loop detection.
+    qword IdleTicksSkipped();
+
+    // The number of bytes of the Gate Array's rendered pen table that were rewritten as a result of pen colour changes
+    // in the last frame completed, where each frame starts at a VSync. When rendering with SSSE3, the table isn't used,
+    // and this instead counts the 16 bytes of pen colours reloaded after each change.
+    qword PenBytesRewritten();
+
+    // When enabled, nothing is rendered to the screen buffer and no audio samples are generated, though the hardware
+    // continues to run exactly as it otherwise would. Rendering can be re-enabled at any time, such as for the last
+    // frame before a screenshot.
+    void EnableHeadless(bool enabled);
+
+    // Renders only the first of every given number of frames, where each frame starts at a VSync. The other frames are
+    // emulated exactly as normal, but nothing is drawn to the screen, nor are they published to the frame buffers or
+    // checked for dirty lines. A value of 0 or 1 renders every frame. Alternatively, a host can render only the frames
+    // it will present by enabling or disabling headless mode before each call to RunUntil with stopVSync.
+    void SetFrameSkip(dword frames);
+
+    // Where the CPU supports it, characters are rendered using SSSE3 instructions by default. Disabling this causes
+    // the Gate Array's precomputed table of rendered bytes to be used instead.
+    void EnableSSSE3Rendering(bool enabled);
+
     void EnableLowerROM(bool enabled);
     void SetLowerRom(Mem16k& lowerRom);
     void EnableUpperROM(bool enabled);
@@ -103,7 +230,7 @@ public:
 
     friend std::ostringstream& operator<<(std::ostringstream& s, const Core& core);
 
-    SERIALIZE_MEMBERS(
+    SERIALIZE_MEMBERS_WITH_POSTREAD(
         AF,
         BC,
         DE,
@@ -140,6 +267,11 @@ public:
         _tape,
         _screen)
 
+    void SerializePostRead()
+    {
+        InitAudioStep();
+    }
+
 private:
     // Hardware components.
     Memory _memory;
@@ -156,6 +288,10 @@ private:
     // The CPC's internal "clock"; each tick represents 0.25 microseconds.
     qword _ticks;
 
+    // Tracks when the FDC and tape next need to be ticked. Only used during RunUntil; outside of that,
+    // these devices are always up to date.
+    Scheduler _scheduler;
+
     byte BusRead(const word& addr);
     void BusWrite(const word& addr, byte b);
 
@@ -165,26 +301,92 @@ private:
     // Runs the CPC for the specified number of ticks.
     void Tick(byte ticks);
 
-    // Runs all non-Z80 hardware for the specified number of ticks.
-    void NonCPUTick(byte ticks);
+    // Runs all non-Z80 hardware for the specified number of microseconds, starting from the given microsecond.
+    void NonCPUTick(qword us, dword ticks);
+
+    // Runs the CPC for the specified number of microseconds while the Z80 is idle.
+    void IdleTick(dword us);
+
+    // Lazy tick members. _pendingUs is the number of microseconds the non-Z80 hardware is behind the Z80, and
+    // _lazyHorizon is the number it can fall behind before it has to be brought up to date. _lazyVideoPages
+    // is a bitmask of the 16K pages the CRTC can read from until then.
+    bool _lazyTicks = false;
+    dword _pendingUs;
+    dword _lazyHorizon;
+    byte _lazyVideoPages;
+
+    void CatchUp();
+    void UpdateLazyHorizon();
+
+    // Scheduled device methods.
+    void ScheduleDevices();
+    void SyncDevice(ScheduledDevice device, qword us);
+    void SyncDevices();
+    void RunScheduledDevices(qword us);
+    dword PSGTicksToNextEvent() const;
 
     // Audio/Video rendering methods.
+    bool _headless = false;
+    dword _frameSkip = 1;
+    dword _frameSkipCount = 0;
+    bool _skipFrame = false;
+    bool _ssse3Rendering = GateArray::SSSE3Supported();
+
     void VideoRender();
+    template<typename T> void RenderVideoRun(byte* pLine, const T* pColours);
+    void UpdateDirtyLines();
+    void StartVideoRun();
     void AudioRender();
+    void AudioAmplitudes(byte (&amps)[3]);
+    void InitAudioStep();
 
-    // Audio members.
+    // Audio members. Within each second, sample n is generated at microsecond floor(n * 1000000 / _frequency). Rather
+    // than computing this for each sample, the whole and fractional number of microseconds between samples are added
+    // to _audioTicksToNextSample and _audioTicksRemainder (which is in units of 1/_frequency microseconds) instead.
     dword _frequency = 48000;
     dword _audioTickTotal;
     dword _audioTicksToNextSample;
     dword _audioSampleCount;
+    dword _audioTicksPerSample;
+    dword _audioTicksPerSampleRemainder;
+    dword _audioTicksRemainder;
+
+    // For the 16 bit audio formats, the sum of each channel's level over the _audioLevelTicks microseconds since the
+    // last sample.
+    AudioFormat _audioFormat = audioAmplitudes;
+    dword _audioLevels[3];
+    dword _audioLevelTicks;
 
     byte MemReadRequest(word addr);
     void MemWriteRequest(word addr, byte b);
     byte BusReadRequest(word addr);
     void BusWriteRequest(word addr, byte b);
 
-    // Z80 execution methods.
-    void Step(byte stopReason);
+    bool _blockExecution = false;
+
+    // Idle loop members. _idleLoopPC is the target of the last backward jump, and the other members record the state
+    // of the Z80 when execution last arrived there. _idleLoopClean is cleared by anything that means the iteration since
+    // then can't be repeated without having an effect, such as writing a new value to memory or accepting an interrupt.
+    bool _idleSkip = false;
+    qword _idleTicksSkipped;
+    bool _idleLoopClean;
+    word _idleLoopPC;
+    qword _idleLoopTicks;
+    byte _idleLoopR;
+    std::array<word, 12> _idleLoopRegisters;
+
+    std::array<word, 12> IdleLoopRegisters();
+    void StartIdleLoop();
+
+    // Z80 execution methods. RunLoop and ExecuteBlock are specialized on whether they need to stop at the start of a
+    // VSync and which execution features are enabled, so that they don't have to check after every instruction.
+    template<bool stopOnVSync, bool blockExecution, bool idleSkip>
+    byte RunLoop(qword stopTicks);
+    void Step();
+    template<bool stopOnVSync, bool idleSkip>
+    bool ExecuteBlock(qword stopTicks);
+    bool SkipHalt(qword stopTicks, byte stopReason);
+    void SkipIdleLoop(word pc, qword stopTicks);
     void Execute(byte op);
     void ExecuteCB();
     void ExecuteED();
@@ -192,14 +394,69 @@ private:
     void ExecuteDDFDCB(word& xy);
     bool HandleInterrupt();
 
+    // Rather than rendering each character as the CRTC reaches it, runs of consecutive characters on the same scan line
+    // are rendered together when the CRTC reaches the end of the line or starts or ends an HSync, or just before
+    // anything they depend on is written to. _videoRunLength is the number of characters waiting to be rendered, and
+    // the other members record the CRTC's state at the first of them. _videoRunPages is a bitmask of the 16K pages
+    // they could read from.
+    word _videoRunLength;
+    byte _videoRunX;
+    word _videoRunY;
+    byte _videoRunHCount;
+    word _videoRunMemoryAddress;
+    byte _videoRunRaster;
+    bool _videoRunVerticalDisplay;
+    bool _videoRunInHSync;
+    bool _videoRunInSync;
+    bool _videoRunInVSync;
+    byte _videoRunPages;
+
     // Screen buffer.
     word _scrPitch;
     word _scrHeight;
     word _scrWidth;
     bytevector _screen;
 
+    // Triple buffered frames, if enabled.
+    std::unique_ptr<FrameBuffers> _pFrameBuffers;
+    FrameReadyCallback _frameReadyCallback;
+    void* _pFrameReadyContext;
+
+    // Scan line hashes for the frame being rendered and the previous one, if dirty lines are being tracked.
+    std::vector<qword> _lineHashes;
+    std::vector<qword> _previousLineHashes;
+    bytevector _dirtyLines;
+
+    // Caller's screen buffer, if any.
+    byte* _pScreenBuffer;
+    size_t _screenBufferPitch;
+    ScreenFormat _screenFormat;
+    word _rgb565Colours[32];
+
     wordvector* _pAudioSamples;
 
+    dword _keyframeInterval = 50;
+    size_t _keyframeDiffBytes = 0x100000;
+    dword _snapshotsSinceKeyframe;
+    size_t _diffBytesSinceKeyframe;
+    size_t _snapshotBudget = 0;
+
+    // The snapshots' ids in order of when they were taken, the number of bytes they hold, and the ticks at the last
+    // thinning pass.
+    std::set<std::pair<qword, int>> _snapshotTicks;
+    size_t _snapshotBytes;
+    qword _thinnedTicks;
+
+    void ThinSnapshots();
+    void ThinSnapshots(int64_t from, int64_t to, qword spacing);
+    void EvictSnapshot(int id);
+
+    // Caller's audio ring buffer, if any, and the same again while RunUntil is generating samples.
+    std::unique_ptr<AudioRingBuffer> _pAudioRingBuffer;
+    AudioRingBuffer* _pAudioRing;
+
+    void WriteAudioSamples(const word* pSamples, byte count);
+
 #pragma region "Flag helpers"
     bool Sign() { return ((F &  flagS) != 0); }
     bool Zero() { return ((F &  flagZ) != 0); }
@@ -369,28 +626,23 @@ private:
 
     byte SZ(byte n)
     {
-        return Zero8(n) | Sign8(n);
+        return flagTables._sz[n];
     }
 
     byte SZ35(byte n)
     {
-        return Flags35(n) | SZ(n);
+        return flagTables._sz35[n];
     }
 
     byte SZP35(byte n)
     {
-        return SZ35(n) | Parity(n);
+        return flagTables._szp35[n];
     }
 
     byte Parity(byte b)
     {
         // Parity flag is true if parity of argument is even, and is false otherwise
-        byte t = b;
-        t ^= (t >> 4);
-        t ^= (t >> 2);
-        t ^= (t >> 1);
-
-        return ((t & 0x01) == 0) ? flagPV : 0;
+        return flagTables._parity[b];
     }
 #pragma endregion
 
@@ -1176,12 +1428,7 @@ private:
     {
         // M1 (continued)
         r++;
-        F = Sign8(r) |
-            ((r == 0x80) ? flagPV : 0) |
-            (F & flagC) |
-            Zero8(r) |
-            ((LowNibble(r) == 0x00) ? flagH : 0) |
-            Flags35(r);
+        F = flagTables._inc[r] | (F & flagC);
     }
 
     // INC (HL)
@@ -1223,13 +1470,7 @@ private:
     {
         // M1 (continued)
         r--;
-        F = Sign8(r) |
-            ((r == 0x7F) ? flagPV : 0) |
-            (F & flagC) |
-            Zero8(r) |
-            ((LowNibble(r) == 0x0F) ? flagH : 0) |
-            Flags35(r) |
-            flagN;
+        F = flagTables._dec[r] | (F & flagC);
     }
 
     // DEC (HL)
@@ -1271,33 +1512,13 @@ private:
     // DAA
     void DAA()
     {
-        // M1 (continued
-        bool cflag = false;
-        byte corr = 0;
-        byte ABefore = A;
-        if ((A > 0x99) || Carry())
-        {
-            corr |= 0x60;
-            cflag = true;
-        }
-
-        if ((LowNibble(A) > 0x09) || HalfCarry())
-        {
-            corr |= 0x06;
-        }
-
-        if (AddSubtract())
-        {
-            A -= corr;
-        }
-        else
-        {
-            A += corr;
-        }
+        // M1 (continued)
+        word index = A |
+            (Carry() ? daaCarry : 0) |
+            (HalfCarry() ? daaHalfCarry : 0) |
+            (AddSubtract() ? daaAddSubtract : 0);
 
-        F = (F & ~flagC) | (cflag?flagC:0);
-        F = (F & ~flagH) | ((A ^ ABefore) & flagH);
-        F = (F & ~(flagS | flagZ | flagPV | flag3 | flag5)) | SZP35(A);
+        AF = flagTables._daa[index];
     }
 
     // CPL
@@ -1,25 +1,32 @@
 #pragma once
 
+#include <algorithm>
+
 #include "common.h"
 #include "Blob.h"
+#include "Memory.h"
 #include "Serialize.h"
 
 // Optimized core storage.
 struct CoreSnapshot
 {
 public:
-    CoreSnapshot()
+    CoreSnapshot() : _keyframe(true), _deleted(false), _ticks(0)
     {
         _coreStuff = std::make_shared<Blob>();
     }
 
-    CoreSnapshot(Core& core, std::shared_ptr<CoreSnapshot>& parentSnapshot)
+    CoreSnapshot(Core& core, std::shared_ptr<CoreSnapshot>& parentSnapshot, bool keyframe) : _deleted(false), _ticks(0)
     {
-        Create(core, parentSnapshot);
+        Create(core, parentSnapshot, keyframe);
     }
 
-    void Create(Core& core, std::shared_ptr<CoreSnapshot>& parentSnapshot)
+    // A keyframe's core is never turned into a diff against its child, and it stores every page of RAM, so reverting
+    // to any snapshot only has to decode the diffs between it and the nearest keyframe.
+    void Create(Core& core, std::shared_ptr<CoreSnapshot>& parentSnapshot, bool keyframe)
     {
+        _keyframe = keyframe;
+
         std::unique_ptr<bytevector> serializedCore;
         if (parentSnapshot == nullptr || parentSnapshot->_recycledCore == nullptr)
         {
@@ -34,15 +41,218 @@ public:
 
         _coreStuff = std::make_shared<Blob>(serializedCore);
 
-        if (parentSnapshot != nullptr)
+        // There's no point turning a deleted snapshot into a diff, as it's only being kept until this one replaces it.
+        if (parentSnapshot != nullptr && !parentSnapshot->_keyframe && !parentSnapshot->_deleted)
         {
             _recycledCore = parentSnapshot->_coreStuff->SetDiffParent(_coreStuff);
         }
     }
 
-    // Serializable stuff that can be stored as a full image or a compressed diff.
+    // Stores the pages of RAM written to since memoryParent was created or reverted to, or every page if there
+    // isn't one, so the cost depends on how much RAM has changed rather than how much there is.
+    void StorePages(Memory& memory, std::shared_ptr<CoreSnapshot>& memoryParent)
+    {
+        if (!_keyframe)
+        {
+            _memoryParent = memoryParent;
+        }
+
+        for (word page = 0; page < memPageCount; page++)
+        {
+            if (_memoryParent == nullptr || memory.PageDirty(page))
+            {
+                const byte* pPage = memory.Page(page);
+
+                _pageNumbers.push_back(page);
+                _pages.insert(_pages.end(), pPage, pPage + memPageSize);
+            }
+        }
+
+        memory.ClearDirtyPages();
+    }
+
+    // Adds the pages stored by the snapshot's memory parent that it doesn't already store itself, so it no longer
+    // depends on that snapshot.
+    void SkipMemoryParent()
+    {
+        std::shared_ptr<CoreSnapshot> parent = _memoryParent;
+
+        std::vector<bool> stored(memPageCount, false);
+        for (word page : _pageNumbers)
+        {
+            stored[page] = true;
+        }
+
+        for (size_t i = 0; i < parent->_pageNumbers.size(); i++)
+        {
+            word page = parent->_pageNumbers[i];
+            if (!stored[page])
+            {
+                const byte* pPage = parent->_pages.data() + i * memPageSize;
+
+                _pageNumbers.push_back(page);
+                _pages.insert(_pages.end(), pPage, pPage + memPageSize);
+            }
+        }
+
+        _memoryParent = parent->_memoryParent;
+    }
+
+    // Called when the snapshot is deleted, so that no other snapshot depends on it. The snapshot whose core is stored as
+    // a diff against this one's has its diff combined with this one's, and any snapshots whose RAM depends on this one
+    // take the pages they need from it. The cost only depends on the size of the snapshots involved, not on how many
+    // snapshots there are. Returns the change in the number of bytes used by the other snapshots.
+    int64_t Unlink()
+    {
+        _deleted = true;
+        int64_t bytesChange = 0;
+
+        std::shared_ptr<CoreSnapshot> older = _olderDiff.lock();
+        std::shared_ptr<CoreSnapshot> newer = _newerDiff.lock();
+        if (older != nullptr && older->_coreStuff->DiffParent() == _coreStuff)
+        {
+            bytesChange -= older->Bytes();
+            older->_coreStuff->SkipDiffParent();
+            bytesChange += older->Bytes();
+        }
+
+        // Neither neighbour may be left pointing at this snapshot, as it can outlive its deletion.
+        bool relink = (older != nullptr && newer != nullptr && older->_coreStuff->DiffParent() == newer->_coreStuff);
+        if (older != nullptr)
+        {
+            older->_newerDiff = relink ? newer : nullptr;
+        }
+
+        if (newer != nullptr)
+        {
+            newer->_olderDiff = relink ? older : nullptr;
+        }
+
+        for (std::weak_ptr<CoreSnapshot>& weakChild : _memoryChildren)
+        {
+            std::shared_ptr<CoreSnapshot> child = weakChild.lock();
+            if (child == nullptr || child->_memoryParent.get() != this)
+            {
+                continue;
+            }
+
+            bytesChange -= child->Bytes();
+            child->SkipMemoryParent();
+            bytesChange += child->Bytes();
+
+            if (_memoryParent != nullptr)
+            {
+                _memoryParent->AddMemoryChild(child);
+            }
+        }
+
+        _memoryChildren.clear();
+        _olderDiff.reset();
+        _newerDiff.reset();
+
+        return bytesChange;
+    }
+
+    void AddMemoryChild(std::shared_ptr<CoreSnapshot>& child)
+    {
+        auto expired = [](const std::weak_ptr<CoreSnapshot>& c) { return c.expired(); };
+        _memoryChildren.erase(std::remove_if(_memoryChildren.begin(), _memoryChildren.end(), expired), _memoryChildren.end());
+
+        _memoryChildren.push_back(child);
+    }
+
+    // The number of snapshots storing only some pages between this one and the one storing all of them.
+    dword PageDepth() const
+    {
+        dword depth = 0;
+        const CoreSnapshot* pSnapshot = this;
+        for (; pSnapshot->_memoryParent != nullptr; pSnapshot = pSnapshot->_memoryParent.get())
+        {
+            depth++;
+        }
+
+        return depth;
+    }
+
+    // The size of the pages stored by those snapshots.
+    size_t PageChainBytes() const
+    {
+        size_t bytes = 0;
+        const CoreSnapshot* pSnapshot = this;
+        for (; pSnapshot->_memoryParent != nullptr; pSnapshot = pSnapshot->_memoryParent.get())
+        {
+            bytes += pSnapshot->_pages.size();
+        }
+
+        return bytes;
+    }
+
+    // The number of bytes used to store the snapshot.
+    size_t Bytes() const
+    {
+        return _coreStuff->StoredSize() + _pages.size() + _pageNumbers.size() * sizeof(word);
+    }
+
+    // The number of bytes used to store this snapshot and those whose cores this one's is a diff against, directly or
+    // indirectly, all of which are turned back into full images when this snapshot's core is decoded.
+    size_t DiffChainBytes() const
+    {
+        size_t bytes = Bytes();
+        for (std::shared_ptr<CoreSnapshot> newer = _newerDiff.lock(); newer != nullptr; newer = newer->_newerDiff.lock())
+        {
+            bytes += newer->Bytes();
+        }
+
+        return bytes;
+    }
+
+    // Restores each page of RAM from the most recent snapshot, starting with this one, which stored it.
+    void RestorePages(Memory& memory) const
+    {
+        std::vector<bool> restored(memPageCount, false);
+        word remaining = memPageCount;
+
+        const CoreSnapshot* pSnapshot = this;
+        while (pSnapshot != nullptr && remaining > 0)
+        {
+            for (size_t i = 0; i < pSnapshot->_pageNumbers.size(); i++)
+            {
+                word page = pSnapshot->_pageNumbers[i];
+                if (!restored[page])
+                {
+                    memcpy(memory.Page(page), pSnapshot->_pages.data() + i * memPageSize, memPageSize);
+                    restored[page] = true;
+                    remaining--;
+                }
+            }
+
+            pSnapshot = pSnapshot->_memoryParent.get();
+        }
+
+        memory.ClearDirtyPages();
+    }
+
+    // Serializable stuff that can be stored as a full image or a compressed diff. This doesn't include RAM.
     std::shared_ptr<Blob> _coreStuff;
 
+    // The pages of RAM stored by this snapshot, and the snapshot holding any other pages.
+    wordvector _pageNumbers;
+    bytevector _pages;
+    std::shared_ptr<CoreSnapshot> _memoryParent;
+
+    // The snapshots whose RAM may depend on this one's.
+    std::vector<std::weak_ptr<CoreSnapshot>> _memoryChildren;
+
+    // The snapshot whose core is stored as a diff against this one's, and the one this one's is a diff against.
+    std::weak_ptr<CoreSnapshot> _olderDiff;
+    std::weak_ptr<CoreSnapshot> _newerDiff;
+
+    bool _keyframe;
+    bool _deleted;
+
+    // When the snapshot was created.
+    qword _ticks;
+
     std::unique_ptr<bytevector> _recycledCore;
 };
 
@@ -1,5 +1,15 @@
 #include "Encode.h"
 
+// SSE2 intrinsics are always available when building for x86 with MSVC, but other compilers need them to be enabled.
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define ENCODE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 int FindNextRunOfSameBytes(byte* pBytes, int size, int start, int minRunLength, int& runLength)
 {
     int runstart = start;
@@ -67,8 +77,91 @@ void AddRun(byte* pBytes, bytevector& encoded, int start, int end, bool same)
     }
 }
 
+void WriteVarint(byte*& p, size_t value)
+{
+    while (value >= 0x80)
+    {
+        *p++ = (byte)(value | 0x80);
+        value >>= 7;
+    }
+
+    *p++ = (byte)value;
+}
+
+size_t VarintSize(size_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+
+    return size;
+}
+
+bool ReadVarint(const byte*& p, const byte* pEnd, size_t& value)
+{
+    value = 0;
+    for (int shift = 0; p < pEnd && shift < 64; shift += 7)
+    {
+        byte b = *p++;
+        value |= (size_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool RunLengthDecodeVersion2(const bytevector& encodedBytes, bytevector& decoded)
+{
+    const byte* p = encodedBytes.data() + 1;
+    const byte* pEnd = encodedBytes.data() + encodedBytes.size();
+
+    size_t size = 0;
+    if (!ReadVarint(p, pEnd, size))
+    {
+        return false;
+    }
+
+    // As the decoded bytes start out as zero, runs only need to be skipped over.
+    decoded.assign(size, 0);
+    byte* pOut = decoded.data();
+    byte* pOutEnd = pOut + size;
+
+    while (p < pEnd)
+    {
+        size_t header = 0;
+        if (!ReadVarint(p, pEnd, header))
+        {
+            return false;
+        }
+
+        size_t len = header >> 1;
+        size_t literalLen = (header & 1) ? 0 : len;
+        if (len > (size_t)(pOutEnd - pOut) || literalLen > (size_t)(pEnd - p))
+        {
+            return false;
+        }
+
+        memcpy(pOut, p, literalLen);
+        p += literalLen;
+        pOut += len;
+    }
+
+    return (pOut == pOutEnd);
+}
+
 bool RunLengthDecode(const bytevector& encodedBytes, bytevector& decoded)
 {
+    if (!encodedBytes.empty() && encodedBytes[0] == encodeVersion2)
+    {
+        return RunLengthDecodeVersion2(encodedBytes, decoded);
+    }
+
     decoded.clear();
 
     int i = 0;
@@ -133,3 +226,175 @@ bool RunLengthEncode(byte* pBuffer, size_t size, bytevector& encoded)
     return true;
 }
 
+
+// Collects the records for the XOR of a buffer with its parent, as the bytes of the literals, which are written into
+// a buffer with room for the whole of the XORed buffer, and the header of each record. Zeroes are held back until it's
+// known whether they make a long enough run to be worth a record of their own.
+class XorEncoder
+{
+public:
+    XorEncoder(byte* pLiterals, std::vector<size_t>& headers) :
+        _pLiterals(pLiterals), _headers(headers), _literalLength(0), _zeroes(0)
+    {
+    }
+
+    void Zeroes(size_t count)
+    {
+        _zeroes += count;
+    }
+
+    void Literal(const byte* pBytes, size_t count)
+    {
+        FlushZeroes();
+
+        memcpy(_pLiterals, pBytes, count);
+        _pLiterals += count;
+        _literalLength += count;
+    }
+
+    void Finish()
+    {
+        FlushZeroes();
+        EndLiteral();
+    }
+
+private:
+    byte* _pLiterals;
+    std::vector<size_t>& _headers;
+    size_t _literalLength;
+    size_t _zeroes;
+
+    void FlushZeroes()
+    {
+        if (_zeroes >= xorMinRunLength)
+        {
+            EndLiteral();
+            _headers.push_back((_zeroes << 1) | 1);
+        }
+        else if (_zeroes > 0)
+        {
+            memset(_pLiterals, 0, _zeroes);
+            _pLiterals += _zeroes;
+            _literalLength += _zeroes;
+        }
+
+        _zeroes = 0;
+    }
+
+    void EndLiteral()
+    {
+        if (_literalLength > 0)
+        {
+            _headers.push_back(_literalLength << 1);
+            _literalLength = 0;
+        }
+    }
+};
+
+#ifdef ENCODE_SSE2
+inline int LowestBit(dword mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+void XorRunLengthEncode(const byte* pBuffer, size_t size, const byte* pParent, size_t parentSize, bytevector& encoded)
+{
+    // The literals and headers are collected in scratch buffers kept between calls, so only the encoded bytes
+    // themselves need to be allocated.
+    static thread_local bytevector literals;
+    static thread_local std::vector<size_t> headers;
+    if (literals.size() < size)
+    {
+        literals.resize(size);
+    }
+
+    headers.clear();
+    XorEncoder encoder(literals.data(), headers);
+
+    size_t commonSize = (parentSize < size) ? parentSize : size;
+    size_t i = 0;
+
+#ifdef ENCODE_SSE2
+    // Each block's mask of non-zero bytes is split into its alternating runs of zero and non-zero bytes, so blocks
+    // which are entirely zero (by far the most common) cost no more than a compare.
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= commonSize; i += 16)
+    {
+        __m128i diff = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)(pBuffer + i)),
+            _mm_loadu_si128((const __m128i*)(pParent + i)));
+
+        dword nonZero = (~_mm_movemask_epi8(_mm_cmpeq_epi8(diff, zero))) & 0xFFFF;
+        if (nonZero == 0)
+        {
+            encoder.Zeroes(16);
+            continue;
+        }
+
+        alignas(16) byte block[16];
+        _mm_store_si128((__m128i*)block, diff);
+
+        int b = 0;
+        while (nonZero != 0)
+        {
+            int first = LowestBit(nonZero);
+            int end = first + LowestBit(~(nonZero >> first));
+
+            encoder.Zeroes(first - b);
+            encoder.Literal(block + first, end - first);
+
+            b = end;
+            nonZero &= ~((1 << end) - 1);
+        }
+
+        encoder.Zeroes(16 - b);
+    }
+#endif
+
+    for (; i < size; i++)
+    {
+        byte b = (i < commonSize) ? (pBuffer[i] ^ pParent[i]) : pBuffer[i];
+        if (b == 0)
+        {
+            encoder.Zeroes(1);
+        }
+        else
+        {
+            encoder.Literal(&b, 1);
+        }
+    }
+
+    encoder.Finish();
+
+    size_t encodedSize = 1 + VarintSize(size);
+    for (size_t header : headers)
+    {
+        encodedSize += VarintSize(header) + (((header & 1) == 0) ? (header >> 1) : 0);
+    }
+
+    encoded.resize(encodedSize);
+    byte* pOut = encoded.data();
+    *pOut++ = encodeVersion2;
+    WriteVarint(pOut, size);
+
+    const byte* pLiterals = literals.data();
+    for (size_t header : headers)
+    {
+        WriteVarint(pOut, header);
+
+        if ((header & 1) == 0)
+        {
+            size_t len = header >> 1;
+            memcpy(pOut, pLiterals, len);
+            pOut += len;
+            pLiterals += len;
+        }
+    }
+}
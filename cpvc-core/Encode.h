@@ -2,6 +2,19 @@
 
 #include "common.h"
 
+// Decodes either format; the original, where each record is a byte giving its type followed by a 4 byte length, or
+// version 2, which begins with encodeVersion2 (never the type of an original record), followed by the decoded size
+// and then each record's header as LEB128 varints. A record's header is its length shifted left by one, with bit 0
+// set for a run of zeroes, or clear for a literal, in which case the bytes themselves follow.
+constexpr byte encodeVersion2 = 0x02;
 bool RunLengthDecode(const bytevector& encodedBytes, bytevector& decoded);
+
+// Encodes in the original format.
 bool RunLengthEncode(byte* pBuffer, size_t size, bytevector& encoded);
 
+// Run length encodes the XOR of the buffer with its parent (treating any bytes past the end of the parent as zero), in
+// version 2 format, in a single pass and without making a copy of the XORed buffer. Only runs of zeroes at least
+// xorMinRunLength long are encoded as runs, as a shorter run costs more in headers than it saves.
+constexpr size_t xorMinRunLength = 4;
+void XorRunLengthEncode(const byte* pBuffer, size_t size, const byte* pParent, size_t parentSize, bytevector& encoded);
+
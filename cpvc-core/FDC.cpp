@@ -438,6 +438,46 @@ void FDC::Tick()
     }
 }
 
+void FDC::Tick(dword ticks)
+{
+    while (ticks > 0)
+    {
+        dword ticksToNextEvent = TicksToNextEvent();
+        if (ticks < ticksToNextEvent)
+        {
+            // Nothing will happen in this time other than the read timeout counting down (and only
+            // if a Read Data command was the last one executed).
+            if ((_commandBytes[0] & 0x1f) == cmdReadData)
+            {
+                _readTimeout = (int8_t)(_readTimeout - (int)(ticks & 0xff));
+            }
+
+            return;
+        }
+
+        _readTimeout = (int8_t)(_readTimeout - (int)((ticksToNextEvent - 1) & 0xff));
+        Tick();
+
+        ticks -= ticksToNextEvent;
+    }
+}
+
+dword FDC::TicksToNextEvent() const
+{
+    if ((_commandBytes[0] & 0x1f) != cmdReadData || _execIndex >= _execByteCount)
+    {
+        return ticksNever;
+    }
+
+    // Note that the timeout is decremented before being checked, and that it wraps from -128 to 127.
+    if (_readTimeout > 0)
+    {
+        return _readTimeout;
+    }
+
+    return (_readTimeout == -128) ? 128 : 1;
+}
+
 void FDC::CmdReadData()
 {
     SetDataDirection(fdcDataOut);
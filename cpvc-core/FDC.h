@@ -6,6 +6,7 @@
 #include "Disk.h"
 
 #include "Phase.h"
+#include "Scheduler.h"
 
 #include "Serialize.h"
 
@@ -140,6 +141,13 @@ public:
     // Emulates one microsecond of time for the FDC.
     void Tick();
 
+    // Emulates the specified number of microseconds of time for the FDC.
+    void Tick(dword ticks);
+
+    // Returns the number of microseconds until the FDC next has to do something other than count down its
+    // read timeout, or ticksNever if it's idle.
+    dword TicksToNextEvent() const;
+
 public:
     byte _readBuffer[readBufferSize];
     byte _readBufferIndex;
@@ -0,0 +1,4 @@
+#include "FlagTables.h"
+
+// Flag lookup tables shared by all instances of Core.
+const FlagTables flagTables;
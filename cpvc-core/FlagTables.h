@@ -0,0 +1,86 @@
+#pragma once
+
+#include "common.h"
+
+// Z80 flags
+constexpr byte flagS = 0x80;     // Sign flag
+constexpr byte flagZ = 0x40;     // Zero flag
+constexpr byte flag5 = 0x20;     // Undocumented bit 5 flag
+constexpr byte flagH = 0x10;     // Half-carry flag
+constexpr byte flag3 = 0x08;     // Undocumented bit 3 flag
+constexpr byte flagPV = 0x04;    // Parity/Overflow flag
+constexpr byte flagN = 0x02;     // Add/Subtract flag
+constexpr byte flagC = 0x01;     // Carry flag
+
+// Index into the DAA table is the value of A, combined with the following bits for the state of the
+// Carry, Half-carry and Add/Subtract flags.
+constexpr word daaCarry = 0x100;
+constexpr word daaHalfCarry = 0x200;
+constexpr word daaAddSubtract = 0x400;
+
+// Lookup tables for flags which would otherwise have to be calculated bit by bit for each instruction.
+// Each table is indexed by an instruction's 8-bit result.
+class FlagTables
+{
+public:
+    constexpr FlagTables() : _sz(), _sz35(), _szp35(), _parity(), _inc(), _dec(), _daa()
+    {
+        for (int n = 0; n < 256; n++)
+        {
+            byte b = (byte)n;
+
+            byte t = b;
+            t ^= (t >> 4);
+            t ^= (t >> 2);
+            t ^= (t >> 1);
+
+            _parity[n] = ((t & 0x01) == 0) ? flagPV : 0;
+            _sz[n] = ((b == 0) ? flagZ : 0) | (b & flagS);
+            _sz35[n] = _sz[n] | (b & (flag3 | flag5));
+            _szp35[n] = _sz35[n] | _parity[n];
+
+            // Flags following INC r or DEC r (excluding the Carry flag, which is unaffected) where r is
+            // the result.
+            _inc[n] = _sz35[n] | ((b == 0x80) ? flagPV : 0) | (((b & 0x0F) == 0x00) ? flagH : 0);
+            _dec[n] = _sz35[n] | ((b == 0x7F) ? flagPV : 0) | (((b & 0x0F) == 0x0F) ? flagH : 0) | flagN;
+        }
+
+        for (int i = 0; i < 0x800; i++)
+        {
+            byte a = (byte)i;
+            bool cflag = false;
+            byte corr = 0;
+
+            if ((a > 0x99) || ((i & daaCarry) != 0))
+            {
+                corr |= 0x60;
+                cflag = true;
+            }
+
+            if (((a & 0x0F) > 0x09) || ((i & daaHalfCarry) != 0))
+            {
+                corr |= 0x06;
+            }
+
+            byte result = ((i & daaAddSubtract) != 0) ? (byte)(a - corr) : (byte)(a + corr);
+            byte f = _szp35[result] |
+                ((result ^ a) & flagH) |
+                (cflag ? flagC : 0) |
+                (((i & daaAddSubtract) != 0) ? flagN : 0);
+
+            _daa[i] = (word)((result << 8) | f);
+        }
+    }
+
+    byte _sz[256];
+    byte _sz35[256];
+    byte _szp35[256];
+    byte _parity[256];
+    byte _inc[256];
+    byte _dec[256];
+
+    // Resulting AF following DAA.
+    word _daa[0x800];
+};
+
+extern const FlagTables flagTables;
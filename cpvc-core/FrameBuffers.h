@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+
+#include "common.h"
+
+// Three frame buffers shared between a thread rendering frames and a thread presenting them. The renderer always draws
+// into the back buffer, and publishes it by exchanging it with the ready buffer. The presenter exchanges its front
+// buffer with the ready buffer only when a newer frame has been published, so each thread always has a buffer to
+// itself, and neither has to wait for, or copy from, the other.
+//
+// Note this is kept out of Core.h, as <atomic> can't be included when compiling with /clr.
+class FrameBuffers
+{
+public:
+    FrameBuffers(size_t size) : _sequence(0), _back(0), _front(2), _ready(1)
+    {
+        for (int f = 0; f < 3; f++)
+        {
+            _buffers[f].resize(size);
+            _sequences[f] = 0;
+        }
+    }
+
+    ~FrameBuffers()
+    {
+    }
+
+    // The buffer the next frame should be rendered into.
+    byte* Back()
+    {
+        return _buffers[_back].data();
+    }
+
+    // Makes the back buffer the latest frame, and returns its sequence number.
+    qword Publish()
+    {
+        _sequence++;
+        _sequences[_back] = _sequence;
+        _back = _ready.exchange(_back | _fresh, std::memory_order_acq_rel) & _indexMask;
+
+        return _sequence;
+    }
+
+    // Returns the latest frame published, and its sequence number. This remains valid until the next call.
+    const byte* Latest(qword& sequence)
+    {
+        if ((_ready.load(std::memory_order_acquire) & _fresh) != 0)
+        {
+            _front = _ready.exchange(_front, std::memory_order_acq_rel) & _indexMask;
+        }
+
+        sequence = _sequences[_front];
+
+        return _buffers[_front].data();
+    }
+
+private:
+    constexpr static byte _indexMask = 0x03;
+    constexpr static byte _fresh = 0x04;
+
+    bytevector _buffers[3];
+    qword _sequences[3];
+    qword _sequence;
+
+    // Only the renderer uses _back, and only the presenter uses _front.
+    byte _back;
+    byte _front;
+
+    // The index of the ready buffer, along with _fresh if it hasn't yet been taken by the presenter.
+    std::atomic<byte> _ready;
+};
@@ -1,6 +1,10 @@
 #include "common.h"
 #include "GateArray.h"
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 inline byte Nibble(bool b3, bool b2, bool b1, bool b0)
 {
     return
@@ -80,6 +84,25 @@ void Mode3(byte(&pixels)[8], byte(&pens)[16], byte b)
     pixels[7] = pens[pen1];
 }
 
+const PenNumberTables penNumberTables;
+
+// The pens which can appear on screen in each mode.
+constexpr word modePens[4] = { 0xFFFF, 0x000F, 0x0003, 0x000F };
+
+bool GateArray::SSSE3Supported()
+{
+#if !defined(GATEARRAY_SSSE3)
+    return false;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+
+    return (info[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+}
+
 GateArray::GateArray(Memory& memory, bool& pInterruptRequested, byte& pScanLineCount) : _memory(memory), _interruptRequested(pInterruptRequested), _scanLineCount(pScanLineCount)
 {
     Reset();
@@ -95,10 +118,18 @@ void GateArray::Reset()
     _border = 0;
     _mode = 0;
     memset(_pen, 0, sizeof(_pen) / sizeof(_pen[0]));
+    _penBytesRewritten = 0;
+    _penBytesRewrittenLastFrame = 0;
 
     RenderPens();
 }
 
+void GateArray::EndFrame()
+{
+    _penBytesRewrittenLastFrame = _penBytesRewritten;
+    _penBytesRewritten = 0;
+}
+
 void GateArray::RenderPens()
 {
     for (int b = 0; b < 256; b++)
@@ -108,6 +139,31 @@ void GateArray::RenderPens()
         Mode2(_renderedPenBytes[2][b], _pen, b);
         Mode3(_renderedPenBytes[3][b], _pen, b);
     }
+
+    memset(_dirtyPens, 0, sizeof(_dirtyPens));
+    _penColoursChanged = false;
+}
+
+void GateArray::UpdateRenderedPenBytes(byte mode)
+{
+    word dirtyPens = _dirtyPens[mode];
+    const byte (&penNumbers)[256][8] = penNumberTables._pens[mode];
+    byte (&rendered)[256][8] = _renderedPenBytes[mode];
+
+    for (int b = 0; b < 256; b++)
+    {
+        for (int p = 0; p < 8; p++)
+        {
+            byte pen = penNumbers[b][p];
+            if (Bit(dirtyPens, pen))
+            {
+                rendered[b][p] = _pen[pen];
+                _penBytesRewritten++;
+            }
+        }
+    }
+
+    _dirtyPens[mode] = 0;
 }
 
 void GateArray::Write(byte b)
@@ -124,9 +180,20 @@ void GateArray::Write(byte b)
         }
         else
         {
-            _pen[_selectedPen & 0x0F] = b & 0x1F;
-
-            RenderPens();
+            byte pen = _selectedPen & 0x0F;
+            if (_pen[pen] != (b & 0x1F))
+            {
+                _pen[pen] = b & 0x1F;
+
+                // Rather than rendering the pens again now, just note which modes' rendered pen bytes are affected,
+                // and update them when they're next used.
+                for (byte mode = 0; mode < 4; mode++)
+                {
+                    _dirtyPens[mode] |= (modePens[mode] & (1 << pen));
+                }
+
+                _penColoursChanged = true;
+            }
         }
         break;
     case 0x80:
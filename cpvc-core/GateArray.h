@@ -8,6 +8,84 @@
 
 #include "Serialize.h"
 
+// SSSE3 intrinsics are always available when building for x86 with MSVC, but other compilers need them to be enabled.
+// They're left out when compiling with /clr, such as for the CLR wrapper, which reaches this header through Core.h
+// but never renders anything itself.
+#if (defined(_M_IX86) || defined(_M_X64) || defined(__SSSE3__)) && !defined(__cplusplus_cli)
+#define GATEARRAY_SSSE3
+#include <tmmintrin.h>
+#endif
+
+// The pen numbers of the 8 pixels given by each byte of screen memory, in each mode. Unlike the Gate Array's rendered
+// pen bytes, these don't depend on the colours assigned to the pens, so can be computed at compile time.
+class PenNumberTables
+{
+public:
+    constexpr PenNumberTables() : _pens()
+    {
+        for (int b = 0; b < 256; b++)
+        {
+            for (int p = 0; p < 8; p++)
+            {
+                // Mode 0 - two pixels, each with four bits interleaved across the byte.
+                int b0 = 7 - (p / 4);
+                _pens[0][b][p] = (byte)(((b >> b0) & 1) | (((b >> (b0 - 4)) & 1) << 1) | (((b >> (b0 - 2)) & 1) << 2) | (((b >> (b0 - 6)) & 1) << 3));
+
+                // Mode 1 - four pixels, each with two bits.
+                int b1 = 7 - (p / 2);
+                _pens[1][b][p] = (byte)(((b >> b1) & 1) | (((b >> (b1 - 4)) & 1) << 1));
+
+                // Mode 2 - eight pixels, each with one bit.
+                _pens[2][b][p] = (byte)((b >> (7 - p)) & 1);
+
+                // Mode 3 - as mode 0, but only the first two bits of each pixel.
+                _pens[3][b][p] = (byte)(_pens[0][b][p] & 0x03);
+            }
+        }
+    }
+
+    byte _pens[4][256][8];
+};
+
+extern const PenNumberTables penNumberTables;
+
+// The colours of the Gate Array's 32 hardware colours, as 0x00RRGGBB. As each of red, green and blue can only be off,
+// half or full intensity, only 27 of these are distinct.
+constexpr dword hardwareColours[32] = {
+    0x808080, // 0x00 - White
+    0x808080, // 0x01 - White
+    0x00FF80, // 0x02 - Sea Green
+    0xFFFF80, // 0x03 - Pastel Yellow
+    0x000080, // 0x04 - Blue
+    0xFF0080, // 0x05 - Purple
+    0x008080, // 0x06 - Cyan
+    0xFF8080, // 0x07 - Pink
+    0xFF0080, // 0x08 - Purple
+    0xFFFF80, // 0x09 - Pastel Yellow
+    0xFFFF00, // 0x0A - Bright Yellow
+    0xFFFFFF, // 0x0B - Bright White
+    0xFF0000, // 0x0C - Bright Red
+    0xFF00FF, // 0x0D - Bright Magenta
+    0xFF8000, // 0x0E - Orange
+    0xFF80FF, // 0x0F - Pastel Magenta
+    0x000080, // 0x10 - Blue
+    0x00FF80, // 0x11 - Sea Green
+    0x00FF00, // 0x12 - Bright Green
+    0x00FFFF, // 0x13 - Bright Cyan
+    0x000000, // 0x14 - Black
+    0x0000FF, // 0x15 - Bright Blue
+    0x008000, // 0x16 - Green
+    0x0080FF, // 0x17 - Sky Blue
+    0x800080, // 0x18 - Magenta
+    0x80FF80, // 0x19 - Pastel Green
+    0x80FF00, // 0x1A - Lime
+    0x80FFFF, // 0x1B - Pastel Cyan
+    0x800000, // 0x1C - Red
+    0x8000FF, // 0x1D - Mauve
+    0x808000, // 0x1E - Yellow
+    0x8080FF  // 0x1F - Pastel Blue
+};
+
 class GateArray : public IBusNoAddressWriteOnly
 {
 public:
@@ -25,12 +103,73 @@ public:
 
     byte _renderedPenBytes[4][256][8];
 
+    // For each mode, the pens whose colours have changed since that mode's rendered pen bytes were last updated.
+    word _dirtyPens[4];
+
+    // Whether any pen's colour has changed since PenColours last loaded them.
+    bool _penColoursChanged;
+
+    // The number of bytes of _renderedPenBytes rewritten due to pen colour changes in the current frame, and in the
+    // last frame completed. When rendering with SSSE3, the 16 pen colours reloaded by PenColours are counted instead.
+    qword _penBytesRewritten;
+    qword _penBytesRewrittenLastFrame;
+
     void Reset();
 
+    // Called at the start of each VSync to begin counting the bytes rewritten for a new frame.
+    void EndFrame();
+
     void Write(byte b);
 
     void RenderPens();
 
+    // Returns the rendered pen bytes for the given mode, first updating only those bytes whose pixels use a pen that
+    // has changed colour since the mode's bytes were last needed.
+    byte (&RenderedPenBytes(byte mode))[256][8]
+    {
+        if (_dirtyPens[mode] != 0)
+        {
+            UpdateRenderedPenBytes(mode);
+        }
+
+        return _renderedPenBytes[mode];
+    }
+
+    // Returns true if the CPU supports the SSSE3 instructions used by ExpandPixels.
+    static bool SSSE3Supported();
+
+#ifdef GATEARRAY_SSSE3
+    // Returns the colours of the 16 pens, for use with ExpandPixels.
+    __m128i PenColours()
+    {
+        if (_penColoursChanged)
+        {
+            _penBytesRewritten += sizeof(_pen);
+            _penColoursChanged = false;
+        }
+
+        return _mm_loadu_si128((const __m128i*) _pen);
+    }
+
+    // Renders the 16 pixels of a character from the two bytes of screen memory the CRTC reads for it. This gives the
+    // same result as copying each byte's entry in _renderedPenBytes, but uses a single shuffle to look up the colours
+    // of all 16 pixels' pens at once, so doesn't need _renderedPenBytes to be up to date.
+    void ExpandPixels(byte* pPixels, byte b0, byte b1, const __m128i& colours) const
+    {
+        const byte (&pens)[256][8] = penNumberTables._pens[_mode];
+
+        __m128i penNumbers = _mm_unpacklo_epi64(
+            _mm_loadl_epi64((const __m128i*) pens[b0]),
+            _mm_loadl_epi64((const __m128i*) pens[b1]));
+
+        _mm_storeu_si128((__m128i*) pPixels, _mm_shuffle_epi8(colours, penNumbers));
+    }
+#endif
+
+private:
+    void UpdateRenderedPenBytes(byte mode);
+
+public:
     friend StreamWriter& operator<<(StreamWriter& s, const GateArray& gateArray);
     friend StreamReader& operator>>(StreamReader& s, GateArray& gateArray);
 
@@ -11,6 +11,11 @@
 #include "StreamReader.h"
 #include "StreamWriter.h"
 
+// RAM is divided into pages of this size, so incremental snapshots only need to store those written to.
+constexpr word memPageSize = 0x100;
+constexpr word memPagesPerBank = 0x4000 / memPageSize;
+constexpr word memPageCount = 8 * memPagesPerBank;
+
 inline Mem16k CreateMem16k(byte* pBuffer)
 {
     Mem16k mem;
@@ -36,6 +41,10 @@ private:
     const byte* _readRAM[4];
     byte* _writeRAM[4];
 
+    // A bit for each page of each bank, set when the page is written to.
+    qword _dirtyPages[8];
+    byte _writeBanks[4];
+
     byte _ramConfig;
     const byte _ramConfigs[8][4] = {
         { 0, 1, 2, 3 },
@@ -65,6 +74,8 @@ public:
             mem.fill(0);
         }
 
+        MarkPagesDirty();
+
         _lowerRomEnabled = true;
         _upperRomEnabled = true;
 
@@ -89,6 +100,34 @@ public:
     {
         byte bankIndex = addr >> 14;
         _writeRAM[bankIndex][addr & 0x3FFF] = b;
+        _dirtyPages[_writeBanks[bankIndex]] |= 1ull << ((addr & 0x3FFF) / memPageSize);
+    }
+
+    // Returns true if the page has been written to since the last call to ClearDirtyPages.
+    bool PageDirty(word page) const
+    {
+        return (_dirtyPages[page / memPagesPerBank] & (1ull << (page % memPagesPerBank))) != 0;
+    }
+
+    byte* Page(word page)
+    {
+        return _banks[page / memPagesPerBank].data() + (page % memPagesPerBank) * memPageSize;
+    }
+
+    void ClearDirtyPages()
+    {
+        for (qword& dirty : _dirtyPages)
+        {
+            dirty = 0;
+        }
+    }
+
+    void MarkPagesDirty()
+    {
+        for (qword& dirty : _dirtyPages)
+        {
+            dirty = 0xFFFFFFFFFFFFFFFF;
+        }
     }
 
     void SetLowerROM(const Mem16k& lowerRom)
@@ -136,7 +175,8 @@ public:
     {
         for (byte b = 0; b < 4; b++)
         {
-            _readRAM[b] = _writeRAM[b] = _banks[_ramConfigs[_ramConfig][b]].data();
+            _writeBanks[b] = _ramConfigs[_ramConfig][b];
+            _readRAM[b] = _writeRAM[b] = _banks[_writeBanks[b]].data();
         }
 
         if (_lowerRomEnabled)
@@ -180,6 +220,8 @@ public:
         s >> memory._lowerRom;
         s >> memory._upperRoms;
 
+        memory.MarkPagesDirty();
+
         // Probably more consistent to serialize each read and write bank separately, as it's not
         // guaranteed that they will be in sync with _ramConfig, even though they should be!
         memory.ConfigureRAM();
@@ -210,8 +252,8 @@ public:
         return s;
     }
 
+    // Note that RAM isn't included here, as snapshots store it separately, one page at a time (see CoreSnapshot).
     SERIALIZE_MEMBERS_WITH_POSTREAD(
-        _banks,
         _ramConfig,
         _lowerRomEnabled,
         _upperRomEnabled,
@@ -83,6 +83,20 @@ void PSG::Amplitudes(byte(&amp)[3])
     amp[2] = ChannelAmplitude(_amplitudeC, ToneEnableC(), NoiseEnableC(), _state[2]);
 }
 
+// Returns the number of ticks until a counter which is incremented every tick is reset to zero by reaching the given
+// period, or ticksNever if it never will be (as the counter wraps around before reaching it).
+dword TicksToReset(word counter, dword period)
+{
+    if (period > 0xFFFF)
+    {
+        return ticksNever;
+    }
+
+    word next = (word)(counter + 1);
+
+    return (next >= period) ? 1 : (1 + period - next);
+}
+
 void PSG::TickChannelState(word& tone, word& ticksCounter, bool& state)
 {
     ticksCounter++;
@@ -122,44 +136,7 @@ void PSG::Tick()
             _envelopeStepCount = 0;
             _envelopePeriodCount++;
 
-            // Advance to next envelope state...
-            switch (_register[13] & 0x0f)
-            {
-            case 0x00:
-            case 0x01:
-            case 0x02:
-            case 0x03:
-            case 0x04:
-            case 0x05:
-            case 0x06:
-            case 0x07:
-                _envelopeState = envSustainLow;
-                break;
-            case 0x08:
-                break;
-            case 0x09:
-                _envelopeState = envSustainLow;
-                break;
-            case 0x0a:
-                _envelopeState = envAttack;
-                _register[13] = 0x0e;
-                break;
-            case 0x0b:
-                _envelopeState = envSustainHigh;
-                break;
-            case 0x0c:
-                break;
-            case 0x0d:
-                _envelopeState = envSustainHigh;
-                break;
-            case 0x0e:
-                _envelopeState = envRelease;
-                _register[13] = 0x0a;
-                break;
-            case 0x0f:
-                _envelopeState = envSustainLow;
-                break;
-            }
+            NextEnvelopeState();
         }
 
         switch (_envelopeState)
@@ -172,6 +149,181 @@ void PSG::Tick()
     }
 }
 
+// Advances to the next envelope state at the end of each cycle of 16 steps.
+void PSG::NextEnvelopeState()
+{
+    switch (_register[13] & 0x0f)
+    {
+    case 0x00:
+    case 0x01:
+    case 0x02:
+    case 0x03:
+    case 0x04:
+    case 0x05:
+    case 0x06:
+    case 0x07:
+        _envelopeState = envSustainLow;
+        break;
+    case 0x08:
+        break;
+    case 0x09:
+        _envelopeState = envSustainLow;
+        break;
+    case 0x0a:
+        _envelopeState = envAttack;
+        _register[13] = 0x0e;
+        break;
+    case 0x0b:
+        _envelopeState = envSustainHigh;
+        break;
+    case 0x0c:
+        break;
+    case 0x0d:
+        _envelopeState = envSustainHigh;
+        break;
+    case 0x0e:
+        _envelopeState = envRelease;
+        _register[13] = 0x0a;
+        break;
+    case 0x0f:
+        _envelopeState = envSustainLow;
+        break;
+    }
+}
+
+// Advances a counter which is incremented every tick, and reset to zero when it reaches the given period, by the given
+// number of ticks. Returns the number of times the counter was reset.
+dword AdvanceCounter(word& counter, dword period, dword ticks)
+{
+    dword first = TicksToReset(counter, period);
+    if (ticks < first)
+    {
+        counter = (word)(counter + ticks);
+        return 0;
+    }
+
+    // Note that a period of zero causes the counter to be reset on every tick.
+    dword repeat = (period == 0) ? 1 : period;
+    ticks -= first;
+    counter = (word)(ticks % repeat);
+
+    return 1 + (ticks / repeat);
+}
+
+void PSG::Tick(dword ticks)
+{
+    if (AdvanceCounter(_toneTicks[0], _toneA * 16 / 2, ticks) & 1)
+    {
+        _state[0] = !_state[0];
+    }
+
+    if (AdvanceCounter(_toneTicks[1], _toneB * 16 / 2, ticks) & 1)
+    {
+        _state[1] = !_state[1];
+    }
+
+    if (AdvanceCounter(_toneTicks[2], _toneC * 16 / 2, ticks) & 1)
+    {
+        _state[2] = !_state[2];
+    }
+
+    dword noiseSteps = AdvanceCounter(_noiseTicks, (_noisePeriod & 0x1f) * 16 / 2, ticks);
+    for (dword n = 0; n < noiseSteps; n++)
+    {
+        word newBit = ((1 ^ (_noiseRandom >> 15) ^ (_noiseRandom >> 12)) & 0x0001);
+        _noiseRandom = newBit | (_noiseRandom << 1);
+        _noiseAmplitude = (newBit != 0);
+    }
+
+    StepEnvelope(AdvanceCounter(_envelopeTickCounter, _envelopePeriod * (256 / 16), ticks));
+}
+
+// Advances the envelope by the given number of steps.
+void PSG::StepEnvelope(dword steps)
+{
+    if (steps == 0)
+    {
+        return;
+    }
+
+    dword stepsToCycleEnd = 16 - _envelopeStepCount;
+    if (steps < stepsToCycleEnd)
+    {
+        _envelopeStepCount += (byte)steps;
+    }
+    else
+    {
+        steps -= stepsToCycleEnd;
+        dword cycles = 1 + (steps / 16);
+        _envelopeStepCount = (byte)(steps % 16);
+        _envelopePeriodCount += (word)cycles;
+
+        // Only shapes 0x0a and 0x0e alternate between states from one cycle to the next; the others settle after one.
+        NextEnvelopeState();
+        if ((cycles % 2) == 0)
+        {
+            NextEnvelopeState();
+        }
+    }
+
+    switch (_envelopeState)
+    {
+    case envSustainLow:    _envelopeStepState = 0x00;                         break;
+    case envSustainHigh:   _envelopeStepState = 0x0f;                         break;
+    case envAttack:        _envelopeStepState = _envelopeStepCount;           break;
+    case envRelease:       _envelopeStepState = 0x0f - _envelopeStepCount;    break;
+    }
+}
+
+dword PSG::TicksToNextEvent() const
+{
+    dword ticks = ticksNever;
+
+    const byte amplitudes[3] = { _amplitudeA, _amplitudeB, _amplitudeC };
+    const word tones[3] = { _toneA, _toneB, _toneC };
+    bool noiseAudible = false;
+    bool envelopeAudible = false;
+
+    for (int c = 0; c < 3; c++)
+    {
+        // A channel with a fixed amplitude of zero is silent regardless of its tone and noise.
+        bool envelope = ((amplitudes[c] & 0x10) != 0);
+        if (!envelope && (amplitudes[c] & 0x0f) == 0)
+        {
+            continue;
+        }
+
+        envelopeAudible |= envelope;
+        noiseAudible |= ((_mixer & (0x08 << c)) == 0);
+
+        if ((_mixer & (0x01 << c)) == 0)
+        {
+            ticks = std::min(ticks, TicksToReset(_toneTicks[c], tones[c] * 16 / 2));
+        }
+    }
+
+    if (noiseAudible)
+    {
+        ticks = std::min(ticks, TicksToReset(_noiseTicks, (_noisePeriod & 0x1f) * 16 / 2));
+    }
+
+    if (envelopeAudible)
+    {
+        dword envelopePeriod = _envelopePeriod * (256 / 16);
+        dword envelopeTicks = TicksToReset(_envelopeTickCounter, envelopePeriod);
+
+        // While sustaining, the envelope's amplitude can only change at the end of a cycle.
+        if (envelopeTicks != ticksNever && (_envelopeState == envSustainLow || _envelopeState == envSustainHigh))
+        {
+            envelopeTicks += (15 - _envelopeStepCount) * ((envelopePeriod == 0) ? 1 : envelopePeriod);
+        }
+
+        ticks = std::min(ticks, envelopeTicks);
+    }
+
+    return ticks;
+}
+
 void PSG::WriteRegister(byte b)
 {
     if (_selectedRegister >= 16)
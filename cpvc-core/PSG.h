@@ -3,9 +3,16 @@
 #include "common.h"
 #include "Keyboard.h"
 #include "IPSG.h"
+#include "Scheduler.h"
 
 #include "Serialize.h"
 
+// The AY-3-8912's output level for each of its 16 (logarithmic) amplitudes, as measured on real hardware. These are
+// scaled so that all three channels at full amplitude can be summed without overflowing a 16 bit signed sample.
+constexpr word ayLevels[16] = {
+    0, 109, 158, 230, 335, 497, 704, 1173, 1383, 2239, 3192, 4072, 5379, 6939, 8799, 10922
+};
+
 class PSG : public IPSG
 {
 public:
@@ -14,8 +21,19 @@ public:
 
     void Reset();
     void Amplitudes(byte (&amp)[3]);
+
+    // Emulates one microsecond of time for the PSG.
     void Tick();
 
+    // Emulates the specified number of microseconds of time for the PSG, giving exactly the same result as calling
+    // Tick that many times, but jumping straight to each tone, noise and envelope transition.
+    void Tick(dword ticks);
+
+    // Returns the number of microseconds until the PSG's amplitudes could next change, or ticksNever if they can't
+    // change until a register is written. Transitions of generators which aren't audible, such as the tone of a
+    // channel whose amplitude is zero, are ignored.
+    dword TicksToNextEvent() const;
+
     byte Read();
     void Write(byte b);
     void SetControl(bool bdir, bool bc1);
@@ -75,6 +93,8 @@ private:
     Keyboard& _keyboard;
 
     void TickChannelState(word& tone, word& ticksCounter, bool& state);
+    void StepEnvelope(dword steps);
+    void NextEnvelopeState();
 
     bool ToneEnableA() { return ((_mixer & 0x01) == 0); };
     bool ToneEnableB() { return ((_mixer & 0x02) == 0); };
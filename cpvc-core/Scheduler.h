@@ -0,0 +1,83 @@
+#pragma once
+
+#include "common.h"
+
+// Devices whose activity is driven by the scheduler rather than being ticked every microsecond.
+enum ScheduledDevice
+{
+    schedFDC,
+    schedTape,
+    schedPSG,
+    schedDeviceCount
+};
+
+// Returned by a device's TicksToNextEvent method when it has nothing scheduled.
+constexpr dword ticksNever = 0xFFFFFFFF;
+
+// Keeps track of the next microsecond at which each scheduled device needs to be ticked, along with
+// the microsecond each device has been brought up to date with. Given the small, fixed number of
+// devices, a flat array with a cached earliest deadline is cheaper than a heap or timing wheel.
+class Scheduler
+{
+public:
+    Scheduler()
+    {
+        Reset(0);
+    }
+
+    ~Scheduler()
+    {
+    }
+
+    // Marks all devices as being up to date at the given microsecond, with nothing scheduled.
+    void Reset(qword us)
+    {
+        for (int d = 0; d < schedDeviceCount; d++)
+        {
+            _synced[d] = us;
+            _deadlines[d] = _never;
+        }
+
+        _next = _never;
+    }
+
+    // Records that the device has been brought up to date with the given microsecond, and that it next
+    // needs to be ticked in the specified number of microseconds (or never, if ticks is ticksNever).
+    void Schedule(ScheduledDevice device, qword us, dword ticks)
+    {
+        _synced[device] = us;
+        _deadlines[device] = (ticks == ticksNever) ? _never : (us + ticks);
+
+        _next = _never;
+        for (qword deadline : _deadlines)
+        {
+            if (deadline < _next)
+            {
+                _next = deadline;
+            }
+        }
+    }
+
+    // The earliest microsecond at which any device needs to be ticked.
+    qword Next() const
+    {
+        return _next;
+    }
+
+    qword Deadline(ScheduledDevice device) const
+    {
+        return _deadlines[device];
+    }
+
+    qword Synced(ScheduledDevice device) const
+    {
+        return _synced[device];
+    }
+
+private:
+    constexpr static qword _never = 0xFFFFFFFFFFFFFFFF;
+
+    qword _deadlines[schedDeviceCount];
+    qword _synced[schedDeviceCount];
+    qword _next;
+};
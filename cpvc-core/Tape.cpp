@@ -104,6 +104,43 @@ void Tape::Tick()
     }
 }
 
+void Tape::Tick(dword ticks)
+{
+    while (ticks > 0)
+    {
+        dword ticksToNextEvent = TicksToNextEvent();
+        if (ticks < ticksToNextEvent)
+        {
+            if (_playing && _motor)
+            {
+                _ticksToNextLevelChange -= 4 * (qword)ticks;
+            }
+
+            return;
+        }
+
+        _ticksToNextLevelChange -= 4 * (qword)(ticksToNextEvent - 1);
+        Tick();
+
+        ticks -= ticksToNextEvent;
+    }
+}
+
+dword Tape::TicksToNextEvent() const
+{
+    if (!_playing || !_motor)
+    {
+        return ticksNever;
+    }
+
+    // Each microsecond consists of four steps, each of which counts down _ticksToNextLevelChange until
+    // it's at most 1, at which point the level changes.
+    qword steps = (_ticksToNextLevelChange <= 1) ? 0 : (_ticksToNextLevelChange - 1);
+    qword ticks = (steps / 4) + 1;
+
+    return (ticks >= ticksNever) ? (ticksNever - 1) : (dword)ticks;
+}
+
 qword Tape::TicksToNextLevelChange()
 {
     qword ticks = 0;
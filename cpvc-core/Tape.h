@@ -9,6 +9,7 @@
 #include "StreamWriter.h"
 
 #include "BlockPhase.h"
+#include "Scheduler.h"
 
 // Macro for adjusting T-State values. Values in .CDT file are for
 // a 3.5MHz clock, whereas we're using a 4MHz clock.
@@ -82,6 +83,11 @@ public:
     void Rewind();
     void Eject();
     void Tick();
+    void Tick(dword ticks);
+
+    // Returns the number of microseconds until the tape level next needs to be updated, or ticksNever if
+    // the tape isn't playing.
+    dword TicksToNextEvent() const;
 
     bytevector _buffer;
 